@@ -1,7 +1,15 @@
 #include "A37434.h"
+#include "A37434_RECORD_STORE.h"
 #include "FIRMWARE_VERSION.h"
 
 unsigned int ETMMath16Delta(unsigned int value_1, unsigned int value_2);
+unsigned long PositionAdd(unsigned long position, unsigned long delta);
+unsigned long PositionSub(unsigned long position, unsigned long delta);
+unsigned long PositionDelta(unsigned long position_1, unsigned long position_2);
+unsigned long PositionScaleQ15(unsigned long position, unsigned int scale);
+unsigned long GetMotorPosition(void);
+void SetMotorTarget(unsigned long position);
+void SetMotorLimits(unsigned long min_position, unsigned long max_position);
 
 // DPARKER Complte adding 5V and 24V monitoring
 // Need to switch the ADC between external and internal triggering
@@ -19,34 +27,52 @@ _FSS(WR_PROT_SEC_OFF & NO_SEC_CODE & NO_SEC_EEPROM & NO_SEC_RAM);         //
 _FGS(GWRP_OFF & GSS_OFF);                                                 //
 _FICD(PGD);                                                               //
 
-const unsigned int PWMHighPowerTable[128] = {FULL_POWER_TABLE_VALUES}; 
+/*
+  The constant tables are in program memory (space(psv)) in one section so that they share a PSV page
+  The compiler does not manage PSVPAG for these tables, and the ISRs are no_auto_psv.
+  Any function that reads them sets PSVPAG to AFC_TABLE_PSV_PAGE and restores it afterwards.
+*/
+#define AFC_TABLE_ATTRIBUTES  __attribute__((space(psv), section(".afc_tables")))
+#define AFC_TABLE_PSV_PAGE    __builtin_psvpage(PWMHighPowerTable)
+
+const unsigned int PWMHighPowerTable[PWM_QUARTER_TABLE_SIZE] AFC_TABLE_ATTRIBUTES = {FULL_POWER_QUARTER_TABLE_VALUES}; 
  /* 
    This table defines the duty cycle for higher current mode (used when the motor is moving)
-   Generated by this spreadsheet
-   https://docs.google.com/spreadsheets/d/1ZgWb8tD-m0kZZ0ukkrMd0YSsf2Md83Dp7B-wVZ7SCRs
+   Generated by tools/generate_tables.py
+   Only the first quarter of the cycle is stored, see PWMTableValue()
 */
 
-const unsigned int PWMLowPowerTable[128]  = {LOW_POWER_TABLE_VALUES};   
+const unsigned int PWMLowPowerTable[PWM_QUARTER_TABLE_SIZE] AFC_TABLE_ATTRIBUTES = {LOW_POWER_QUARTER_TABLE_VALUES};   
 /* 
    This table defines the duty cycle for lower current mode  (used to hold the motor when it is not moving)
-   Generated by this spreadsheet
-   https://docs.google.com/spreadsheets/d/1ZgWb8tD-m0kZZ0ukkrMd0YSsf2Md83Dp7B-wVZ7SCRs
+   Generated by tools/generate_tables.py
+   Only the first quarter of the cycle is stored, see PWMTableValue()
 */
 
-const unsigned int CoolDownTable[256]     = {COOL_DOWN_TABLE_VALUES};
+const unsigned int CoolDownKnots[COOL_DOWN_KNOTS] AFC_TABLE_ATTRIBUTES = {COOL_DOWN_KNOT_VALUES};
 /*
   Cooldown Process
   global_data_A37434.time_off_counter is incremented every 10mS, and reset to zero with every pulse.
   After NO_PULSE_TIME_TO_INITITATE_COOLDOWN without a pulse the cooldown process will start.
   When the cooldown process starts the current position is stored as global_data_A37434.afc_hot_position
-  CoolDownTable provides a Q1.15 multiplier so that position = home_position + CoolDownTable[x] * (afc_hot_position - home_position)
-  CoolDownTable starts at 1 at zero time and reaches zero after 20 minutes
-  Each position in CoolDownTable corresponds to 5.12 seconds.  So the motor is moved once every 5 seconds to match the new cooldown position
-  The table is generated by this spreadsheet
-  https://docs.google.com/spreadsheets/d/1pyvkoiT0XYzaxereZ0c7XMhMmgaBmKexELuavmLmR8k/
+  CoolDownValue(x) provides a Q1.15 multiplier so that position = home_position + CoolDownValue(x) * (afc_hot_position - home_position)
+  CoolDownValue starts at 1 at zero time and reaches zero after 20 minutes
+  Each index x corresponds to 5.12 seconds.  So the motor is moved once every 5 seconds to match the new cooldown position
+  The curve is a sum of thermal time constants, CoolDownKnots holds the knots of a piecewise linear fit to it
+  The knots are generated by tools/generate_tables.py
 */
 
-TYPE_POWER_READINGS power_readings;      // This stores the history of the position and power readings for the previous 16 pulses 
+TYPE_POWER_READINGS power_readings[AFC_ENERGY_BANKS]; // This stores the history of the position and power readings for the previous 16 pulses of each energy
+TYPE_ENERGY_CLASSIFIER energy_classifier;             // Selects which power_readings bank each pulse belongs to
+TYPE_PULSE_SYNC pulse_sync;              // Pulse timing used to keep the motor still during the pulse
+TYPE_BACKLASH_ESTIMATOR backlash;        // Online estimate of the tuner drive backlash
+TYPE_SCAN scan;                          // Tuning curve collected by the home position scan
+TYPE_TELEMETRY telemetry;                // Histograms and run summaries, sent at a low rate instead of logging every pulse
+TYPE_REZERO rezero;                      // Re-reference against the end stop during long idle periods
+TYPE_RUN_NOTICE run_notice;              // Announced start of the next run, used to pre-position the tuner
+TYPE_POWER_MAP power_map;                // Reverse power against position learned from every pulse
+TYPE_AFC_STRATEGY_SELECT afc_strategy;   // Strategy used for each AFC mode and the shadow comparison
+TYPE_DRIVE_MANAGER drive;                // Motor driver current range, decay mode and speed level
 STEPPER_MOTOR afc_motor;                 // This contains the control data for the motor
 AFCControlData global_data_A37434;       // Global variables
 
@@ -55,23 +81,104 @@ unsigned int test_value;
 
 void DoStateMachine(void);
 void InitializeA37434(void);
+void InitializeA37434Services(void);
 void InitializeMotor(void);
 void DoPostPulseProcess(void);
+void LoadPowerCalibration(void);
 
 // AFC Helper Functions
-void DoAFCReversePowerFast(void);
-unsigned int CalculateDirection(unsigned int current_pos, unsigned int previous_pos, unsigned int current_rev_pwr, unsigned int previous_rev_pwr);
-void DoAFCReversePowerSlow(void);
+void DoAFCReversePowerFast(TYPE_POWER_READINGS* bank);
+unsigned int CalculateDirection(unsigned long current_pos, unsigned long previous_pos, unsigned int current_rev_pwr, unsigned int previous_rev_pwr, unsigned int minimum_rev_power_change);
+void UpdateNoiseFloor(TYPE_POWER_READINGS* bank);
+unsigned int MinimumReversePowerChange(TYPE_POWER_READINGS* bank);
+void DoAFCReversePowerSlow(TYPE_POWER_READINGS* bank);
+unsigned int SlowDwellDecision(TYPE_POWER_READINGS* bank);
 void DoAFCReversePower(void);
 unsigned int CheckForAFCFastDone(void);
+unsigned int CheckBankConverged(TYPE_POWER_READINGS* bank);
+unsigned int CheckForStepDisturbance(TYPE_POWER_READINGS* bank);
+unsigned int CheckForOutlier(TYPE_POWER_READINGS* bank);
+unsigned int MedianOfWindow(unsigned int* data);
 void ClearPowerReadings(void);
-
+void ClearBankReadings(TYPE_POWER_READINGS* bank);
+unsigned int ClassifyPulseEnergy(void);
+void SetAFCTargetFromBanks(void);
+void UpdateBacklashEstimate(void);
+
+// AFC Strategy Functions
+const TYPE_AFC_STRATEGY* AFCLiveStrategy(void);
+void AFCFastVoteInit(TYPE_POWER_READINGS* bank);
+void AFCSlowDwellInit(TYPE_POWER_READINGS* bank);
+unsigned long AFCBankTarget(TYPE_POWER_READINGS* bank);
+void AFCStrategyTick(void);
+void AFCShadowInitialize(void);
+void AFCShadowPulse(unsigned int bank_index, unsigned long live_previous_target);
+unsigned int TargetDirection(unsigned long target, unsigned long previous_target);
+
+const TYPE_AFC_STRATEGY AFCStrategies[AFC_STRATEGIES] = {
+  // AFC_STRATEGY_FAST_VOTE
+  {AFCFastVoteInit, DoAFCReversePowerFast, 0, AFCBankTarget},
+  // AFC_STRATEGY_SLOW_DWELL
+  {AFCSlowDwellInit, DoAFCReversePowerSlow, 0, AFCBankTarget}
+};
 
 
 void DoAFCCooldown(void);
+
+// Run Notice Functions
+void RunNoticeStart(unsigned int prf, unsigned int energy_mode, unsigned int time_to_start);
+void RunNoticeTick(void);
+void RunNoticeEnd(void);
+
+// Reverse Power Map Functions
+unsigned int PowerMapBin(unsigned long position);
+void PowerMapRecordPulse(void);
+void PowerMapTick(void);
+unsigned long PowerMapSeed(unsigned long position);
+unsigned int PowerMapDirection(unsigned long position);
+unsigned long PowerMapBestPosition(void);
+unsigned int PowerMapBestBin(void);
+void PowerMapClear(void);
+
+// Home Position Scan Functions
+void ScanStart(void);
+void DoScanTick(void);
+void ScanRecordSample(void);
+void ScanCalculateResult(void);
+
+// Idle Re-zero Functions
+unsigned int RezeroDue(void);
+void RezeroStart(void);
+unsigned int DoRezero(void);
+void RezeroAbort(void);
+void RezeroLog(void);
+void SetMotorPosition(unsigned long position);
+
+// Telemetry Functions
+void TelemetryRecordPulse(void);
+void TelemetryTick(void);
+void TelemetrySendMessage(unsigned int index);
+void TelemetryClearHistograms(void);
+
 void DoA37434(void);
 void UpdateFaults(void);
 unsigned int ShiftIndex(unsigned int index, unsigned int shift);
+unsigned int PWMTableValue(const unsigned int* quarter_table, unsigned int index);
+unsigned int CoolDownValue(unsigned int index);
+unsigned int PulseSyncHoldMotor(void);
+void StepMotor(unsigned int direction);
+void PublishMotorPosition(void);
+void PulseSyncUpdatePrediction(void);
+
+// Motor Drive Management Functions
+void DriveInitialize(void);
+void DriveSetSpeedLevel(unsigned int level);
+void DriveUpdate(unsigned int moved);
+void DriveSetOutputs(void);
+void DriveManagerTick(void);
+void DriveLog(void);
+
+const unsigned int DriveSpeedLevels[DRIVE_SPEED_LEVELS] = {DRIVE_SPEED_LEVEL_VALUES};
 
 
 void ADCTriggerInternal(void);
@@ -90,43 +197,34 @@ void DoStateMachine(void) {
   switch (global_data_A37434.control_state) {
 
   case STATE_STARTUP:
+    /*
+      The motor is started first and drives to the zero end stop under _T1Interrupt
+      while the EEPROM, DAC, SPI and CAN are initialized and the ECB configures the board
+    */
     InitializeA37434();
-    ADCTriggerInternal();
     _TRISG1 = 0;  // FOR DEBUGGING
     afc_motor.min_position = 0;
     afc_motor.max_position = AFC_MOTOR_MAX_POSITION;
     afc_motor.home_position = AFC_MOTOR_MAX_POSITION;
     afc_motor.time_steps_stopped = 0;
-    global_data_A37434.control_state = STATE_WAIT_INIT;
-    break;
+    afc_motor.current_position = AFC_MOTOR_MAX_POSITION;
+    afc_motor.target_position  = 0;
+    PublishMotorPosition();
+    InitializeMotor();
 
-  case STATE_WAIT_INIT:
-    _CONTROL_NOT_CONFIGURED = 1;
+    InitializeA37434Services();
     ADCTriggerInternal();
-    global_data_A37434.startup_delay = 0;
-    while (global_data_A37434.control_state == STATE_WAIT_INIT) {
-      DoA37434();
-      /*
-	if (_CONTROL_NOT_CONFIGURED == 0) {
-	global_data_A37434.control_state = STATE_AUTO_ZERO;
-	}
-      */
-      if (global_data_A37434.startup_delay > 25) {
-	// 250ms have passed
-	global_data_A37434.control_state = STATE_AUTO_ZERO;
-      }
-    }
+    _CONTROL_NOT_CONFIGURED = 1;
+    _STATUS_AFC_AUTO_ZERO_HOME_IN_PROGRESS = 1;
+    global_data_A37434.control_state = STATE_AUTO_ZERO;
     break;
     
     
   case STATE_AUTO_ZERO:
-    InitializeMotor();
-    afc_motor.current_position = AFC_MOTOR_MAX_POSITION;
-    afc_motor.target_position  = 0;
     _STATUS_AFC_AUTO_ZERO_HOME_IN_PROGRESS = 1;
     while (global_data_A37434.control_state == STATE_AUTO_ZERO) {
       DoA37434();
-      if (afc_motor.current_position <= 100) {
+      if (GetMotorPosition() <= AFC_MOTOR_END_STOP_POSITION) {
 	global_data_A37434.control_state = STATE_AUTO_HOME;
       }
     }
@@ -134,18 +232,22 @@ void DoStateMachine(void) {
 
   case STATE_AUTO_HOME:
     ADCTriggerInternal();
-    afc_motor.min_position = AFC_MOTOR_MIN_POSITION;
-    afc_motor.max_position = AFC_MOTOR_MAX_POSITION;
-    afc_motor.target_position = afc_motor.home_position;
-    global_data_A37434.manual_target_position = afc_motor.home_position;
-    global_data_A37434.afc_hot_position = afc_motor.home_position;
+    SetMotorLimits(AFC_MOTOR_MIN_POSITION, AFC_MOTOR_MAX_POSITION);
     _STATUS_AFC_AUTO_ZERO_HOME_IN_PROGRESS = 1;
     while (global_data_A37434.control_state == STATE_AUTO_HOME) {
       DoA37434();
-      if (afc_motor.current_position == afc_motor.home_position) {
-	global_data_A37434.control_state = STATE_RUN_AFC;
+      // The home position can arrive from the ECB while the motor is on its way
+      SetMotorTarget(afc_motor.home_position);
+      if (GetMotorPosition() == afc_motor.home_position) {
+	if ((_CONTROL_NOT_CONFIGURED == 0) || (global_data_A37434.startup_delay >= STARTUP_CONFIGURATION_TIMEOUT)) {
+	  global_data_A37434.control_state = STATE_RUN_AFC;
+	}
       }
     }
+    global_data_A37434.manual_target_position = afc_motor.home_position;
+    global_data_A37434.afc_hot_position = afc_motor.home_position;
+    global_data_A37434.ready_time = global_data_A37434.startup_delay;
+    ClearPowerReadings();
     break;
     
   case STATE_RUN_AFC:
@@ -157,28 +259,86 @@ void DoStateMachine(void) {
       if (global_data_A37434.sample_complete) {
 	DoPostPulseProcess();
 	DoAFCReversePower();
+	TelemetryRecordPulse();
       }
 
       if (_STATUS_AFC_MODE_MANUAL_MODE) {
 	global_data_A37434.control_state = STATE_RUN_MANUAL;
       }
+
+      if (scan.requested) {
+	global_data_A37434.control_state = STATE_SCAN;
+      }
+
+      if (RezeroDue()) {
+	global_data_A37434.control_state = STATE_REZERO;
+      }
     }
     break;
     
     
+  case STATE_REZERO:
+    ADCTriggerINT0();
+    RezeroStart();
+    _STATUS_AFC_REZERO_IN_PROGRESS = 1;
+    while (global_data_A37434.control_state == STATE_REZERO) {
+      DoA37434();
+      if (global_data_A37434.sample_complete || _STATUS_AFC_MODE_MANUAL_MODE || scan.requested) {
+	// Pulsing has started again (or the ECB wants the motor), stop now.  The sample is processed by STATE_RUN_AFC
+	RezeroAbort();
+	global_data_A37434.control_state = STATE_RUN_AFC;
+      } else if (DoRezero()) {
+	global_data_A37434.control_state = STATE_RUN_AFC;
+      }
+    }
+    _STATUS_AFC_REZERO_IN_PROGRESS = 0;
+    break;
+
+
   case STATE_RUN_MANUAL:
     ADCTriggerINT0();
     _STATUS_AFC_AUTO_ZERO_HOME_IN_PROGRESS = 0;
     while (global_data_A37434.control_state == STATE_RUN_MANUAL) {
       DoA37434();
-      afc_motor.target_position = global_data_A37434.manual_target_position;
+      SetMotorTarget(global_data_A37434.manual_target_position);
       if (global_data_A37434.sample_complete) {
 	DoPostPulseProcess();
       }
       if (!_STATUS_AFC_MODE_MANUAL_MODE) {
 	global_data_A37434.control_state = STATE_RUN_AFC;
       }
+
+      if (scan.requested) {
+	global_data_A37434.control_state = STATE_SCAN;
+      }
+    }
+    break;
+
+
+  case STATE_SCAN:
+    ADCTriggerINT0();
+    ScanStart();
+    _STATUS_AFC_SCAN_IN_PROGRESS = 1;
+    while (global_data_A37434.control_state == STATE_SCAN) {
+      DoA37434();
+      if (global_data_A37434.sample_complete) {
+	DoPostPulseProcess();
+	ScanRecordSample();
+      }
+      
+      if (scan.phase == SCAN_PHASE_DONE) {
+	if (_STATUS_AFC_MODE_MANUAL_MODE) {
+	  global_data_A37434.control_state = STATE_RUN_MANUAL;
+	} else {
+	  global_data_A37434.control_state = STATE_RUN_AFC;
+	}
+      }
     }
+    _STATUS_AFC_SCAN_IN_PROGRESS = 0;
+    global_data_A37434.fast_afc_done = 0;
+    global_data_A37434.pulses_on_this_run = 0;
+    global_data_A37434.time_on_this_run = 0;
+    ClearPowerReadings();
     break;
     
 
@@ -193,10 +353,7 @@ void InitializeMotor(void) {
   PIN_MOTOR_DRV_RESET_NOT = 1;
   PIN_MOTOR_DRV_SLEEP_NOT = 1;
 
-  PIN_MOTOR_DRV_ISET_A0   = 0;
-  PIN_MOTOR_DRV_ISET_A1   = 0;
-  PIN_MOTOR_DRV_ISET_B0   = 0;
-  PIN_MOTOR_DRV_ISET_B1   = 0;
+  DriveInitialize();
   
   PTPER   = PTPER_SETTING;
   PWMCON1 = PWMCON1_SETTING;
@@ -212,7 +369,7 @@ void InitializeMotor(void) {
   PDC4    = PDC4_SETTING;
   PTCON   = PTCON_SETTING;
   
-  PR1 = PR1_SETTING;
+  PR1 = drive.cruise_period;
   _T1IF = 0;
   _T1IP = 6;
   _T1IE = 1;
@@ -222,9 +379,10 @@ void InitializeMotor(void) {
 
 
 void InitializeA37434(void) {
-  unsigned char a_sample_cal;
-  unsigned char b_sample_cal;
-  
+  /*
+    Sets up the pins, timers, ADC and interrupts - everything that is needed before the motor is started
+    The slower peripherals and the CAN module are set up by InitializeA37434Services() once the motor is moving
+  */
   TRISA = A37434_TRISA_VALUE;
   TRISB = A37434_TRISB_VALUE;
   TRISC = A37434_TRISC_VALUE;
@@ -239,6 +397,10 @@ void InitializeA37434(void) {
   PR3 = PR3_VALUE_10_MILLISECONDS;
   T3CON = T3CON_VALUE;
   _T3IF = 0;
+
+  PR2 = PR2_VALUE;
+  T2CON = T2CON_VALUE;
+  _T2IE = 0;
   
   ADCON2 = ADCON2_SETTING;
   ADCON3 = ADCON3_SETTING;
@@ -247,17 +409,40 @@ void InitializeA37434(void) {
   ADCSSL = ADCSSL_SETTING;
   ADCON1 = ADCON1_SETTING_INT0;
   
+  _INT0IF = 0;
+  _INT0IP = 7;
+  _INT0IE = 1;
+  _INT0EP = 0;
+
   _INT1IF = 0;
   _INT1IP = 7;
   _INT1IE = 1;
   _INT1EP = 0;
   
+  // The constant tables are read through the PSV window
+  _PSV = 1;
+
   // Initialize the status register and load the inhibit and fault masks
   _FAULT_REGISTER = 0;
   _CONTROL_REGISTER = 0;
   _WARNING_REGISTER = 0;
   _NOT_LOGGED_REGISTER = 0;
-  
+
+  afc_motor.last_direction = MOVE_DOWN;
+  afc_motor.backlash_steps = BACKLASH_DEFAULT_STEPS;
+  afc_motor.backlash_remaining = 0;
+}
+
+
+void InitializeA37434Services(void) {
+  /*
+    EEPROM, DAC, SPI, CAN and the AFC data
+    Called with the motor already moving, the I2C and CAN setup does not hold up the homing
+  */
+  unsigned char a_sample_cal;
+  unsigned char b_sample_cal;
+  unsigned int n;
+
   // Initialize the External EEprom
   ETMEEPromUseExternal();
   ETMEEPromConfigureExternalDevice(EEPROM_SIZE_8K_BYTES, FCY_CLK, ETM_I2C_400K_BAUD, EEPROM_I2C_ADDRESS_0, I2C_PORT_1);
@@ -267,17 +452,12 @@ void InitializeA37434(void) {
   // Initialize the SPI Module
   ConfigureSPI(ETM_SPI_PORT_2, ETM_DEFAULT_SPI_CON_VALUE, ETM_DEFAULT_SPI_CON2_VALUE, ETM_DEFAULT_SPI_STAT_VALUE, SPI_CLK_2_MBIT, FCY_CLK);
   
-  if (ETMEEPromCheckOK() == 0) {
-    // The eeprom is not working
-    // Do not load calibration data from the EEPROM
-    a_sample_cal        = ANALOG_INPUT_NO_CALIBRATION;
-    b_sample_cal        = ANALOG_INPUT_NO_CALIBRATION;
-  } else {
-    a_sample_cal        = ANALOG_INPUT_3;
-    b_sample_cal        = ANALOG_INPUT_4;
-  }
-
-  // Do not use the EEPROM until we update the external eeprom to be more reliable
+  /*
+    The calibration is not loaded by the analog library because it reads the EEPROM without any check
+    The calibration is kept in the record store instead (CRC checked, with a fallback copy) and applied by LoadPowerCalibration()
+    If the eeprom is not working the record store is left empty and the inputs run uncalibrated
+  */
+  RecordStoreInitialize(ETMEEPromCheckOK());
   a_sample_cal        = ANALOG_INPUT_NO_CALIBRATION;
   b_sample_cal        = ANALOG_INPUT_NO_CALIBRATION;
 
@@ -303,16 +483,44 @@ void InitializeA37434(void) {
 			   NO_COUNTER,
 			   NO_COUNTER);
 
+  LoadPowerCalibration();
 
   // Initialize the Can module
   ETMCanSlaveInitialize(CAN_PORT_1, FCY_CLK, ETM_CAN_ADDR_AFC_CONTROL_BOARD, _PIN_RD10, 4, _PIN_RD10, _PIN_RD9);
   ETMCanSlaveLoadConfiguration(37434, 001, FIRMWARE_AGILE_REV, FIRMWARE_BRANCH, FIRMWARE_MINOR_REV);
 
-  power_readings.current_movement_direction = MOVE_DOWN;
-  power_readings.reading_count = 0;
-  power_readings.reading_accumulator = 0;
+  backlash.auto_estimate = BACKLASH_AUTO_ESTIMATE;
+  backlash.estimate = BACKLASH_DEFAULT_STEPS;
+  backlash.measuring = 0;
+
+  energy_classifier.mode = ENERGY_CLASSIFY_NONE;
+  energy_classifier.weight[0] = ENERGY_BANK_WEIGHT_TOTAL - ENERGY_BANK_1_DEFAULT_WEIGHT;
+  energy_classifier.weight[1] = ENERGY_BANK_1_DEFAULT_WEIGHT;
+  for (n = 0; n < AFC_ENERGY_BANKS; n++) {
+    power_readings[n].current_movement_direction = MOVE_DOWN;
+    power_readings[n].reading_count = 0;
+    power_readings[n].reading_accumulator = 0;
+    power_readings[n].pulses_since_seen = ENERGY_BANK_TIMEOUT_PULSES;
+    power_readings[n].outlier_window_index = 0;
+    power_readings[n].outlier_window_count = 0;
+    power_readings[n].outlier_count = 0;
+    power_readings[n].noise_previous_reverse_power = 0;
+    power_readings[n].noise_estimate = 0;
+    power_readings[n].noise_samples = 0;
+    power_readings[n].noise_accumulator = 0;
+  }
+  afc_strategy.fast_strategy = AFC_STRATEGY_DEFAULT_FAST;
+  afc_strategy.slow_strategy = AFC_STRATEGY_DEFAULT_SLOW;
+  afc_strategy.shadow_strategy = AFC_STRATEGY_NONE;
+  AFCShadowInitialize();
   ClearPowerReadings();
 
+  TelemetryClearHistograms();
+  telemetry.mode = TELEMETRY_MODE_OFF;
+  telemetry.stream_period = TELEMETRY_STREAM_PERIOD;
+  telemetry.run_active = 0;
+  telemetry.run_count = 0;
+
 }
 
 
@@ -320,7 +528,15 @@ void InitializeA37434(void) {
 void DoPostPulseProcess(void) {
   global_data_A37434.sample_complete = 0;
   global_data_A37434.time_off_counter = 0;
+  rezero.done_this_idle = 0;
+  rezero.idle_time = 0;
+  if (run_notice.active) {
+    RunNoticeEnd();
+  }
   global_data_A37434.pulses_on_this_run++;
+  if (global_data_A37434.motor_moved_during_pulse) {
+    global_data_A37434.moved_pulse_count++;
+  }
 
 
   // Diode Detector outpus are sampled and converted in 5uV per LSB
@@ -340,7 +556,7 @@ void DoPostPulseProcess(void) {
 
     ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_FAST_LOG_1,
 			    global_data_A37434.sample_index,
-			    global_data_A37434.position_at_trigger,
+			    POSITION_TO_32NDS(global_data_A37434.position_at_trigger),
 			    global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated,
 			    global_data_A37434.forward_power_sample.reading_scaled_and_calibrated);
     
@@ -348,7 +564,7 @@ void DoPostPulseProcess(void) {
 			    global_data_A37434.sample_index,
 			    global_data_A37434.b_adc_reading_internal,
 			    global_data_A37434.a_adc_reading_internal,
-			    0x0000);
+			    global_data_A37434.motor_moved_during_pulse);
   }
 }
 
@@ -356,19 +572,129 @@ void DoPostPulseProcess(void) {
 
 
 void DoAFCReversePower(void) {
+  TYPE_POWER_READINGS* bank;
+  unsigned int bank_index;
+  unsigned long live_previous_target;
+  unsigned int n;
+
+  bank_index = ClassifyPulseEnergy();
+  bank = &power_readings[bank_index];
+  for (n = 0; n < AFC_ENERGY_BANKS; n++) {
+    if (power_readings[n].pulses_since_seen < ENERGY_BANK_TIMEOUT_PULSES) {
+      power_readings[n].pulses_since_seen++;
+    }
+  }
+  bank->pulses_since_seen = 0;
+
+  if (CheckForOutlier(bank)) {
+    // Arc or mis-fire pulse, keep it out of both AFC modes and the backlash estimate
+    bank->outlier_count++;
+    global_data_A37434.outlier_pulse_count++;
+    return;
+  }
+
+  UpdateNoiseFloor(bank);
+  if (bank_index == 0) {
+    PowerMapRecordPulse();
+  }
+  live_previous_target = AFCLiveStrategy()->target(bank);
+
   if (global_data_A37434.fast_afc_done == 1) {
-    DoAFCReversePowerSlow();
-  } else {
-    DoAFCReversePowerFast();
+    if (CheckForStepDisturbance(bank)) {
+      // The tuning has moved away from where slow mode can track it, go back to fast mode
+      global_data_A37434.fast_afc_done = 0;
+      global_data_A37434.pulses_on_this_run = 0;
+      global_data_A37434.time_on_this_run = 0;
+      global_data_A37434.fast_mode_reentry_count++;
+      ClearPowerReadings();
+    } else {
+      AFCStrategies[afc_strategy.slow_strategy].pulse(bank);
+    }
+  }
+
+  if (global_data_A37434.fast_afc_done == 0) {
+    if (bank_index == 0) {
+      // Consecutive pulses from one energy are needed to see the backlash
+      UpdateBacklashEstimate();
+    }
+    AFCStrategies[afc_strategy.fast_strategy].pulse(bank);
+    if (bank->map_tie_break) {
+      power_map.tie_break_count++;
+    }
+    // While the reverse power is stepping the latest readings are not near the minimum so the bank will not converge
+    bank->converged = CheckBankConverged(bank);
     if (CheckForAFCFastDone()) {
       global_data_A37434.fast_afc_done = 1;
       ClearPowerReadings();
     }
-  }    
+  }
+
+  if (afc_strategy.shadow_strategy != AFC_STRATEGY_NONE) {
+    AFCShadowPulse(bank_index, live_previous_target);
+  }
+  
+  SetAFCTargetFromBanks();
+}
+
+
+unsigned int ClassifyPulseEnergy(void) {
+  /*
+    Interleaved dual energy pulses have different reverse power at the same position.
+    Each energy gets its own power_readings bank so that pulses are only compared with pulses at the same energy.
+  */
+  switch (energy_classifier.mode) {
+
+  case ENERGY_CLASSIFY_PULSE_PARITY:
+    return (global_data_A37434.sample_index & 0x0001);
+    
+  case ENERGY_CLASSIFY_CAN_PATTERN:
+    // The ECB provides the energy pattern, one bit per pulse, repeating every 16 pulses
+    return ((energy_classifier.parameter >> (global_data_A37434.sample_index & 0x000F)) & 0x0001);
+    
+  case ENERGY_CLASSIFY_FORWARD_POWER:
+    if (global_data_A37434.forward_power_sample.reading_scaled_and_calibrated >= energy_classifier.parameter) {
+      return 1;
+    }
+    return 0;
+
+  default:
+    return 0;
+  }
+}
+
+
+void SetAFCTargetFromBanks(void) {
+  /*
+    The motor target is the weighted average of the targets from each energy bank
+    Banks that have not seen a pulse recently are not included
+  */
+  unsigned long weighted_total;
+  unsigned int weight_total;
+  unsigned int n;
+  
+  weighted_total = 0;
+  weight_total = 0;
+  for (n = 0; n < AFC_ENERGY_BANKS; n++) {
+    if (power_readings[n].pulses_since_seen < ENERGY_BANK_TIMEOUT_PULSES) {
+      weighted_total += AFCLiveStrategy()->target(&power_readings[n]) * energy_classifier.weight[n];
+      weight_total += energy_classifier.weight[n];
+    }
+  }
+  
+  if (weight_total) {
+    SetMotorTarget(weighted_total / weight_total);
+  }
 }
 
 
 unsigned int CheckForAFCFastDone(void) {
+  /*
+    Fast mode is done when every bank in use has converged
+    MAXIMUM_FAST_MODE_PULSES and MAXIMUM_FAST_MODE_TIME are a backstop in case convergence is never detected
+  */
+  unsigned int n;
+  unsigned int banks_in_use;
+
   if (global_data_A37434.pulses_on_this_run >= MAXIMUM_FAST_MODE_PULSES) {
     return 1;
   }
@@ -377,12 +703,121 @@ unsigned int CheckForAFCFastDone(void) {
     return 1;
   }
 
+  banks_in_use = 0;
+  for (n = 0; n < AFC_ENERGY_BANKS; n++) {
+    if (power_readings[n].pulses_since_seen < ENERGY_BANK_TIMEOUT_PULSES) {
+      banks_in_use++;
+      if (power_readings[n].converged == 0) {
+	return 0;
+      }
+    }
+  }
+  
+  if (banks_in_use) {
+    return 1;
+  }
+
+  return 0;
+}
+
+
+unsigned int CheckBankConverged(TYPE_POWER_READINGS* bank) {
+  /*
+    Fast mode has converged when all of these are true over the power_readings ring
+    The positions are all within CONVERGED_POSITION_SPAN
+    The direction votes are alternating (the motor is dithering around the minimum)
+    The latest reverse power readings are close to the minimum in the ring
+  */
+  unsigned int n;
+  unsigned int index;
+  unsigned long minimum_position;
+  unsigned long maximum_position;
+  unsigned int minimum_reverse_power;
+  unsigned long latest_total;
+  unsigned int alternations;
+  unsigned int history;
+  
+  if (bank->pulses_in_fast_mode < CONVERGED_MIN_PULSES) {
+    return 0;
+  }
+
+  minimum_position = 0xFFFFFFFF;
+  maximum_position = 0;
+  minimum_reverse_power = 0xFFFF;
+  for (n = 0; n < 16; n++) {
+    if ((bank->position[n] == 0) || (bank->reverse_power[n] == 0)) {
+      // The ring is not full yet
+      return 0;
+    }
+    if (bank->position[n] < minimum_position) {
+      minimum_position = bank->position[n];
+    }
+    if (bank->position[n] > maximum_position) {
+      maximum_position = bank->position[n];
+    }
+    if (bank->reverse_power[n] < minimum_reverse_power) {
+      minimum_reverse_power = bank->reverse_power[n];
+    }
+  }
+
+  if ((maximum_position - minimum_position) > CONVERGED_POSITION_SPAN) {
+    return 0;
+  }
+
+  alternations = 0;
+  history = bank->direction_history ^ (bank->direction_history >> 1);
+  for (n = 0; n < CONVERGED_VOTE_HISTORY; n++) {
+    alternations += (history & 0x0001);
+    history >>= 1;
+  }
+  if (alternations < CONVERGED_MIN_ALTERNATIONS) {
+    return 0;
+  }
+  
+  latest_total = 0;
+  index = bank->active_index;
+  for (n = 0; n < 4; n++) {
+    latest_total += bank->reverse_power[index];
+    index = ((index - 1) & 0x000F);
+  }
+  if ((latest_total >> 2) > ETMMath16Add(minimum_reverse_power, CONVERGED_REV_PWR_MARGIN)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+
+unsigned int CheckForStepDisturbance(TYPE_POWER_READINGS* bank) {
+  /*
+    Used in slow mode
+    A step disturbance is DISTURBANCE_PULSES consecutive pulses with reverse power more than DISTURBANCE_REV_PWR_STEP
+    above the average reverse power from the last completed dwell of this bank.
+  */
+  if (bank->disturbance_reference == 0) {
+    // No dwell has completed yet
+    bank->disturbance_count = 0;
+    return 0;
+  }
+
+  if (global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated > ETMMath16Add(bank->disturbance_reference, DISTURBANCE_REV_PWR_STEP)) {
+    bank->disturbance_count++;
+  } else {
+    bank->disturbance_count = 0;
+  }
+
+  if (bank->disturbance_count >= DISTURBANCE_PULSES) {
+    bank->disturbance_count = 0;
+    bank->converged = 0;
+    return 1;
+  }
+
   return 0;
 }
 
 
 
-void DoAFCReversePowerSlow(void) {
+void DoAFCReversePowerSlow(TYPE_POWER_READINGS* bank) {
   /* 
      This strategy is simple
      
@@ -393,96 +828,162 @@ void DoAFCReversePowerSlow(void) {
   */
   
   unsigned int next_direction;
-  unsigned int move_amount;
+  unsigned long move_amount;
+  unsigned int decision;
 
 
   /*
     A positive change in direction of 64 steps (big move size) will result in a natural decrease in reverse power of 40.  This is irreguardless of tuning
   */
   
-  power_readings.reading_accumulator += global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
-  power_readings.reading_count++;
+  bank->reading_accumulator += global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
+  bank->reading_count++;
+
+  decision = SlowDwellDecision(bank);
   
-  if (power_readings.reading_count >= SAMPLES_AT_EACH_POINT) {
+  if (decision != SLOW_DWELL_UNDECIDED) {
     // adjust for position change
 
-    power_readings.reading_accumulator >>= 5;
-    power_readings.average_reverse_power_this_sample = power_readings.reading_accumulator;
+    bank->average_reverse_power_this_sample = bank->reading_accumulator / bank->reading_count;
+    bank->disturbance_reference = bank->average_reverse_power_this_sample;
 
-    if (power_readings.average_reverse_power_this_sample < power_readings.average_reverse_power_previous_sample) {
-      next_direction = power_readings.current_movement_direction;
+    if (decision == SLOW_DWELL_BETTER) {
+      next_direction = bank->current_movement_direction;
       move_amount = MOVE_SIZE_SMALL;
     } else {
       move_amount = MOVE_SIZE_BIG;
-      if (power_readings.current_movement_direction == MOVE_DOWN) {
+      if (bank->current_movement_direction == MOVE_DOWN) {
 	next_direction = MOVE_UP;
       } else {
 	next_direction = MOVE_DOWN;
       }
     }
     
-
     if (next_direction == MOVE_UP) {
-      afc_motor.target_position = ETMMath16Add(afc_motor.target_position,move_amount); 
+      bank->target_position = PositionAdd(bank->target_position,move_amount); 
     } else {
-      afc_motor.target_position = ETMMath16Sub(afc_motor.target_position,move_amount);
+      bank->target_position = PositionSub(bank->target_position,move_amount);
+    }
+
+    bank->average_reverse_power_previous_sample = bank->average_reverse_power_this_sample;
+    bank->previous_reading_accumulator = bank->reading_accumulator;
+    bank->previous_reading_count = bank->reading_count;
+    bank->current_movement_direction = next_direction;
+    bank->reading_count = 0;
+    bank->reading_accumulator = 0;
+
+  }
+}
+
+
+unsigned int SlowDwellDecision(TYPE_POWER_READINGS* bank) {
+  /*
+    Sequential test of this dwell against the previous one, see SLOW_DWELL_SPRT_BOUNDARY
+    n readings in this dwell with sum S, m readings in the previous dwell with sum P
+    T = m*S - n*P is m times the sum of (reading - previous mean)
+    The boundary is SLOW_DWELL_SPRT_BOUNDARY/16 * sigma * (m + n), the (m + n) term includes the uncertainty of the previous mean
+    sigma * 256 / 0.886 is the noise floor estimate * 16, so the comparison is |T| * 256 > BOUNDARY * noise_estimate * (m + n)
+  */
+  signed long difference;
+  unsigned long boundary;
+  unsigned int noise;
+  
+  if ((bank->reading_count >= SLOW_DWELL_MIN_SAMPLES) && bank->previous_reading_count && (bank->noise_samples >= NOISE_FLOOR_MIN_SAMPLES)) {
+    difference = (signed long)bank->previous_reading_count * bank->reading_accumulator;
+    difference -= (signed long)bank->reading_count * bank->previous_reading_accumulator;
+
+    noise = bank->noise_estimate;
+    if (noise < 16) {
+      // Do not let a quiet (or quantized) reading make every difference significant
+      noise = 16;
     }
+    boundary = ((unsigned long)SLOW_DWELL_SPRT_BOUNDARY * noise * (bank->previous_reading_count + bank->reading_count)) >> 8;
 
-    power_readings.average_reverse_power_previous_sample = power_readings.average_reverse_power_this_sample;
-    power_readings.current_movement_direction = next_direction;
-    power_readings.reading_count = 0;
-    power_readings.reading_accumulator = 0;
+    if (difference > (signed long)boundary) {
+      return SLOW_DWELL_WORSE;
+    }
+    if (difference < -(signed long)boundary) {
+      return SLOW_DWELL_BETTER;
+    }
+  }
 
+  if (bank->reading_count >= SAMPLES_AT_EACH_POINT) {
+    // No early decision, compare the averages
+    if ((bank->reading_accumulator / bank->reading_count) < bank->average_reverse_power_previous_sample) {
+      return SLOW_DWELL_BETTER;
+    }
+    return SLOW_DWELL_WORSE;
   }
+
+  return SLOW_DWELL_UNDECIDED;
 }
 
 
 
 
-void DoAFCReversePowerFast(void) {
+void DoAFCReversePowerFast(TYPE_POWER_READINGS* bank) {
   unsigned int relative_index;
   unsigned int calculated_move;
   unsigned int previous_direction;
   unsigned int next_direction;
+  unsigned int map_direction;
+  unsigned int minimum_rev_power_change;
   unsigned int n;
 
-  if (global_data_A37434.position_at_trigger > power_readings.position[power_readings.active_index]) {
+  minimum_rev_power_change = MinimumReversePowerChange(bank);
+
+  if (global_data_A37434.position_at_trigger > bank->position[bank->active_index]) {
     previous_direction = MOVE_UP;
   } else {
     previous_direction = MOVE_DOWN;
   }
   
-  power_readings.active_index++;
-  power_readings.active_index &= 0x000F;
+  bank->active_index++;
+  bank->active_index &= 0x000F;
   
-  power_readings.reverse_power[power_readings.active_index] = global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
-  power_readings.forward_power[power_readings.active_index] = global_data_A37434.forward_power_sample.reading_scaled_and_calibrated;
-  power_readings.position[power_readings.active_index]      = global_data_A37434.position_at_trigger;
+  bank->reverse_power[bank->active_index] = global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
+  bank->forward_power[bank->active_index] = global_data_A37434.forward_power_sample.reading_scaled_and_calibrated;
+  bank->position[bank->active_index]      = global_data_A37434.position_at_trigger;
 
 
-  relative_index = power_readings.active_index;
+  relative_index = bank->active_index;
   calculated_move = 0;
   for (n=0; n<15; n++) {
     // Need to compare the current data with the 15 prevoius samples
     relative_index = ((relative_index - 1) & 0x000F);
     calculated_move += CalculateDirection(global_data_A37434.position_at_trigger,
-					  power_readings.position[relative_index],
+					  bank->position[relative_index],
 					  global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated,
-					  power_readings.reverse_power[relative_index]);
+					  bank->reverse_power[relative_index],
+					  minimum_rev_power_change);
   }
   
+  if (bank->pulses_in_fast_mode < 0xFFFF) {
+    bank->pulses_in_fast_mode++;
+  }
+
+  map_direction = MOVE_NO_DATA;
+  if (bank->uses_power_map) {
+    map_direction = PowerMapDirection(global_data_A37434.position_at_trigger);
+  }
+  bank->map_tie_break = 0;
   if (calculated_move > 15) {
     next_direction = MOVE_DOWN;
-    global_data_A37434.no_decision_counter = 0;
+    bank->no_decision_counter = 0;
   } else if (calculated_move < 15) {
     next_direction = MOVE_UP;
-    global_data_A37434.no_decision_counter = 0;
+    bank->no_decision_counter = 0;
+  } else if (map_direction != MOVE_NO_DATA) {
+    // The votes are tied (or there are no readings yet), go toward the lower side of the power map
+    next_direction = map_direction;
+    bank->no_decision_counter = 0;
+    bank->map_tie_break = 1;
   } else {
-    if (global_data_A37434.no_decision_counter < MAX_NO_DECISION_COUNTER) {
+    if (bank->no_decision_counter < MAX_NO_DECISION_COUNTER) {
       next_direction = previous_direction;  
-      global_data_A37434.no_decision_counter++;
+      bank->no_decision_counter++;
     } else {
-      global_data_A37434.no_decision_counter = 0;
+      bank->no_decision_counter = 0;
       if (previous_direction == MOVE_UP) {
 	next_direction = MOVE_DOWN;
       } else {
@@ -491,16 +992,22 @@ void DoAFCReversePowerFast(void) {
     }
   }
   
+  // Record the votes so that convergence can be detected
+  bank->direction_history <<= 1;
+  if (next_direction == MOVE_UP) {
+    bank->direction_history |= 0x0001;
+  }
+
   // Override the direction calculation if the motor is very far from the home position
 
-  if (global_data_A37434.position_at_trigger > ETMMath16Add(afc_motor.home_position, AFC_CONTROL_WINDOW_RANGE)) {
+  if (global_data_A37434.position_at_trigger > PositionAdd(afc_motor.home_position, AFC_CONTROL_WINDOW_RANGE)) {
     next_direction = MOVE_DOWN;
-    ClearPowerReadings();
+    ClearBankReadings(bank);
   }
 
-  if (global_data_A37434.position_at_trigger < ETMMath16Sub(afc_motor.home_position, AFC_CONTROL_WINDOW_RANGE)) {
+  if (global_data_A37434.position_at_trigger < PositionSub(afc_motor.home_position, AFC_CONTROL_WINDOW_RANGE)) {
     next_direction = MOVE_UP;
-    ClearPowerReadings();
+    ClearBankReadings(bank);
   }
 
 
@@ -508,55 +1015,426 @@ void DoAFCReversePowerFast(void) {
   // Figure out how far and how fast we are going to move
 
   if (next_direction == MOVE_UP) {
-    afc_motor.target_position = ETMMath16Add(afc_motor.current_position, FAST_MOVE_TARGET_DELTA); 
+    bank->target_position = PositionAdd(GetMotorPosition(), FAST_MOVE_TARGET_DELTA); 
   } else {
-    afc_motor.target_position = ETMMath16Sub(afc_motor.current_position, FAST_MOVE_TARGET_DELTA);
+    bank->target_position = PositionSub(GetMotorPosition(), FAST_MOVE_TARGET_DELTA);
   }
 }
 
 
-void ClearPowerReadings(void) {
-  unsigned int n;
-  for (n=0; n<15; n++) {
-    power_readings.reverse_power[n] = 0;
-    power_readings.forward_power[n] = 0;
-    power_readings.position[n] = 0;
+void UpdateBacklashEstimate(void) {
+  /*
+    After a reversal the tuner does not move until the backlash has been taken up.
+    The distance the motor has to travel after a reversal before the reverse power responds is compared 
+    with the distance needed for a response when the motor keeps moving in the same direction.
+    The difference is the backlash that has not been taken up by afc_motor.backlash_steps.
+  */
+  unsigned long position;
+  unsigned int reverse_power;
+  unsigned int direction;
+  unsigned long distance;
+  signed int residual;
+
+  position = global_data_A37434.position_at_trigger;
+  reverse_power = global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
+
+  if (PositionDelta(position, backlash.previous_position) < MINIMUM_POSITION_CHANGE) {
+    // The tuner has not moved since the last pulse
+    return;
   }
-  power_readings.active_index = 0;
-}
-
-
-unsigned int CalculateDirection(unsigned int current_pos, unsigned int previous_pos, unsigned int current_rev_pwr, unsigned int previous_rev_pwr) {
-  unsigned int minimum_rev_power_change;
   
-  if (global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated < 11000) {
-    minimum_rev_power_change = MINIMUM_REV_PWR_CHANGE_11K_MINUS;
-  } else if (global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated < 16000) {
-    minimum_rev_power_change = MINIMUM_REV_PWR_CHANGE_11K_16K;
+  if (position > backlash.previous_position) {
+    direction = MOVE_UP;
   } else {
-    minimum_rev_power_change = MINIMUM_REV_PWR_CHANGE_16K_PLUS;
+    direction = MOVE_DOWN;
   }
-  
-  
-  if ((previous_pos == 0) || (previous_rev_pwr == 0)) {
-    // The buffer is empty (or bad reading) and has no data in it so skip this comp.
-    return MOVE_NO_DATA;
+
+  if (direction != backlash.direction) {
+    // Reversal - measure the response from the turn around point
+    backlash.direction = direction;
+    backlash.measuring = 1;
+    backlash.after_reversal = 1;
+    backlash.reference_position = backlash.previous_position;
+    backlash.reference_reverse_power = reverse_power;
+  } else if (backlash.measuring == 0) {
+    backlash.measuring = 1;
+    backlash.after_reversal = 0;
+    backlash.reference_position = position;
+    backlash.reference_reverse_power = reverse_power;
+  } else {
+    distance = PositionDelta(position, backlash.reference_position);
+    if (distance > BACKLASH_MAX_RESPONSE_DISTANCE) {
+      // The tuner is in a flat area, this measurement is no good
+      backlash.measuring = 0;
+    } else if (ETMMath16Delta(reverse_power, backlash.reference_reverse_power) >= BACKLASH_RESPONSE_REV_PWR_CHANGE) {
+      backlash.measuring = 0;
+      if (backlash.after_reversal == 0) {
+	if (backlash.steady_response_distance == 0) {
+	  backlash.steady_response_distance = distance;
+	} else {
+	  backlash.steady_response_distance -= (backlash.steady_response_distance >> 3);
+	  backlash.steady_response_distance += (distance >> 3);
+	}
+      } else if (backlash.steady_response_distance) {
+	residual = (signed long)distance - (signed long)backlash.steady_response_distance;
+	residual += afc_motor.backlash_steps;
+	backlash.estimate += (residual - backlash.estimate) >> 3;
+	if (backlash.estimate < 0) {
+	  backlash.estimate = 0;
+	}
+	if (backlash.estimate > (signed int)BACKLASH_MAX_STEPS) {
+	  backlash.estimate = BACKLASH_MAX_STEPS;
+	}
+	if (backlash.auto_estimate) {
+	  afc_motor.backlash_steps = backlash.estimate;
+	}
+      }
+    }
   }
   
-  if ((ETMMath16Add(current_pos, MINIMUM_POSITION_CHANGE) > previous_pos) && (ETMMath16Sub(current_pos, MINIMUM_POSITION_CHANGE) < previous_pos)) {
-    // The positions are very close
-    return MOVE_NO_DATA;
-  } 
-  
-  if ((ETMMath16Add(current_rev_pwr, minimum_rev_power_change) > previous_rev_pwr) && (ETMMath16Sub(current_rev_pwr, minimum_rev_power_change) < previous_rev_pwr)) {
-    // The reverse power readings are very close
-    return MOVE_NO_DATA;
+  backlash.previous_position = position;
+}
+
+
+void ClearPowerReadings(void) {
+  /*
+    Clears every bank and starts the strategy for the current AFC mode
+    The shadow banks are cleared at the same time so both strategies start from the same point
+  */
+  unsigned int n;
+  for (n = 0; n < AFC_ENERGY_BANKS; n++) {
+    ClearBankReadings(&power_readings[n]);
+    AFCLiveStrategy()->init(&power_readings[n]);
+    // The power map is only recorded from bank 0 pulses (see DoAFCReversePower)
+    power_readings[n].uses_power_map = (n == 0);
+    afc_strategy.shadow_readings[n].uses_power_map = (n == 0);
+    if (afc_strategy.shadow_strategy != AFC_STRATEGY_NONE) {
+      ClearBankReadings(&afc_strategy.shadow_readings[n]);
+      AFCStrategies[afc_strategy.shadow_strategy].init(&afc_strategy.shadow_readings[n]);
+    }
   }
-  
-  if (current_pos > previous_pos) {
-    if (current_rev_pwr < previous_rev_pwr) {
-      // We need to go up more
-      return MOVE_UP;
+}
+
+
+const TYPE_AFC_STRATEGY* AFCLiveStrategy(void) {
+  if (global_data_A37434.fast_afc_done) {
+    return &AFCStrategies[afc_strategy.slow_strategy];
+  }
+  return &AFCStrategies[afc_strategy.fast_strategy];
+}
+
+
+void AFCFastVoteInit(TYPE_POWER_READINGS* bank) {
+  bank->no_decision_counter = 0;
+}
+
+
+void AFCSlowDwellInit(TYPE_POWER_READINGS* bank) {
+  // The first dwell has nothing to be compared with
+  bank->previous_reading_count = 0;
+}
+
+
+unsigned long AFCBankTarget(TYPE_POWER_READINGS* bank) {
+  return bank->target_position;
+}
+
+
+void AFCStrategyTick(void) {
+  /*
+    Called every 10mS while in STATE_RUN_AFC
+  */
+  const TYPE_AFC_STRATEGY* strategy;
+  unsigned int n;
+
+  strategy = AFCLiveStrategy();
+  if (strategy->tick) {
+    for (n = 0; n < AFC_ENERGY_BANKS; n++) {
+      strategy->tick(&power_readings[n]);
+    }
+  }
+  if (afc_strategy.shadow_strategy != AFC_STRATEGY_NONE) {
+    strategy = &AFCStrategies[afc_strategy.shadow_strategy];
+    if (strategy->tick) {
+      for (n = 0; n < AFC_ENERGY_BANKS; n++) {
+	strategy->tick(&afc_strategy.shadow_readings[n]);
+      }
+    }
+  }
+}
+
+
+void AFCShadowInitialize(void) {
+  /*
+    Resets the shadow banks and the comparison counters
+    Called at startup and when the strategy selection changes
+  */
+  unsigned int n;
+  
+  for (n = 0; n < AFC_ENERGY_BANKS; n++) {
+    afc_strategy.shadow_readings[n].current_movement_direction = MOVE_DOWN;
+    afc_strategy.shadow_readings[n].reading_count = 0;
+    afc_strategy.shadow_readings[n].reading_accumulator = 0;
+    afc_strategy.shadow_readings[n].noise_estimate = 0;
+    afc_strategy.shadow_readings[n].noise_samples = 0;
+    afc_strategy.shadow_readings[n].noise_accumulator = 0;
+  }
+  afc_strategy.pulses_compared = 0;
+  afc_strategy.target_difference_total = 0;
+  afc_strategy.target_difference_max = 0;
+  afc_strategy.direction_agree = 0;
+  afc_strategy.direction_disagree = 0;
+}
+
+
+void AFCShadowPulse(unsigned int bank_index, unsigned long live_previous_target) {
+  /*
+    Runs the shadow strategy on its copy of the bank and compares its target with the live target
+    The shadow never moves the motor, so it sees the reverse power at the positions chosen by the live strategy
+  */
+  TYPE_POWER_READINGS* shadow;
+  TYPE_POWER_READINGS* live;
+  const TYPE_AFC_STRATEGY* strategy;
+  unsigned long shadow_previous_target;
+  unsigned long live_target;
+  unsigned long shadow_target;
+  unsigned int live_direction;
+  unsigned int shadow_direction;
+  unsigned int difference;
+
+  shadow = &afc_strategy.shadow_readings[bank_index];
+  live = &power_readings[bank_index];
+  strategy = &AFCStrategies[afc_strategy.shadow_strategy];
+
+  // The noise floor is a property of the magnetron, not of the strategy
+  shadow->noise_estimate = live->noise_estimate;
+  shadow->noise_samples = live->noise_samples;
+  shadow->noise_accumulator = live->noise_accumulator;
+  shadow->pulses_since_seen = 0;
+
+  shadow_previous_target = strategy->target(shadow);
+  strategy->pulse(shadow);
+  shadow_target = strategy->target(shadow);
+  live_target = AFCLiveStrategy()->target(live);
+
+  difference = POSITION_TO_32NDS(PositionDelta(shadow_target, live_target));
+  afc_strategy.target_difference_total += difference;
+  if (difference > afc_strategy.target_difference_max) {
+    afc_strategy.target_difference_max = difference;
+  }
+  
+  live_direction = TargetDirection(live_target, live_previous_target);
+  shadow_direction = TargetDirection(shadow_target, shadow_previous_target);
+  if ((live_direction != MOVE_NO_DATA) && (shadow_direction != MOVE_NO_DATA)) {
+    if (live_direction == shadow_direction) {
+      afc_strategy.direction_agree++;
+    } else {
+      afc_strategy.direction_disagree++;
+    }
+  }
+  
+  afc_strategy.pulses_compared++;
+  if (afc_strategy.pulses_compared == 0xFFFF) {
+    // Halve everything so the mean stays valid on long runs
+    afc_strategy.pulses_compared >>= 1;
+    afc_strategy.target_difference_total >>= 1;
+    afc_strategy.direction_agree >>= 1;
+    afc_strategy.direction_disagree >>= 1;
+  }
+}
+
+
+unsigned int TargetDirection(unsigned long target, unsigned long previous_target) {
+  if (target > previous_target) {
+    return MOVE_UP;
+  }
+  if (target < previous_target) {
+    return MOVE_DOWN;
+  }
+  return MOVE_NO_DATA;
+}
+
+
+unsigned int CheckForOutlier(TYPE_POWER_READINGS* bank) {
+  /*
+    Running median / MAD filter on the reverse power of this bank
+    Returns 1 if the reading is too far from the median of the recent readings
+    Every reading goes into the window (outliers included) so a real change in reverse power is accepted
+    once it makes up half of the window.  The window is not cleared when the AFC mode changes.
+  */
+  unsigned int window[OUTLIER_WINDOW];
+  unsigned int reading;
+  unsigned int median;
+  unsigned int mad;
+  unsigned long limit;
+  unsigned int outlier;
+  unsigned int n;
+
+  reading = global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
+  outlier = 0;
+
+  if (bank->outlier_window_count >= OUTLIER_WINDOW) {
+    for (n = 0; n < OUTLIER_WINDOW; n++) {
+      window[n] = bank->outlier_window[n];
+    }
+    median = MedianOfWindow(window);
+
+    for (n = 0; n < OUTLIER_WINDOW; n++) {
+      window[n] = ETMMath16Delta(bank->outlier_window[n], median);
+    }
+    mad = MedianOfWindow(window);
+
+    limit = (unsigned long)mad * OUTLIER_MAD_MULTIPLE;
+    if (limit < OUTLIER_MIN_DEVIATION) {
+      limit = OUTLIER_MIN_DEVIATION;
+    }
+    
+    if (ETMMath16Delta(reading, median) > limit) {
+      outlier = 1;
+    }
+  } else {
+    bank->outlier_window_count++;
+  }
+
+  bank->outlier_window[bank->outlier_window_index] = reading;
+  bank->outlier_window_index++;
+  if (bank->outlier_window_index >= OUTLIER_WINDOW) {
+    bank->outlier_window_index = 0;
+  }
+
+  return outlier;
+}
+
+
+unsigned int MedianOfWindow(unsigned int* data) {
+  /*
+    Sorts the OUTLIER_WINDOW values in place and returns the middle one
+    Insertion sort, the window is small
+  */
+  unsigned int n;
+  unsigned int m;
+  unsigned int value;
+
+  for (n = 1; n < OUTLIER_WINDOW; n++) {
+    value = data[n];
+    m = n;
+    while ((m > 0) && (data[m - 1] > value)) {
+      data[m] = data[m - 1];
+      m--;
+    }
+    data[m] = value;
+  }
+  return data[OUTLIER_WINDOW >> 1];
+}
+
+
+void ClearBankReadings(TYPE_POWER_READINGS* bank) {
+  unsigned int n;
+  for (n=0; n<15; n++) {
+    bank->reverse_power[n] = 0;
+    bank->forward_power[n] = 0;
+    bank->position[n] = 0;
+  }
+  bank->active_index = 0;
+  bank->pulses_in_fast_mode = 0;
+  bank->direction_history = 0;
+  bank->converged = 0;
+  bank->disturbance_count = 0;
+  bank->disturbance_reference = 0;
+  bank->map_tie_break = 0;
+  bank->target_position = afc_motor.target_position;
+}
+
+
+void UpdateNoiseFloor(TYPE_POWER_READINGS* bank) {
+  /*
+    Estimates the pulse to pulse noise of the reverse power from consecutive pulses of this bank at an unchanged position
+    Slow mode holds the motor still for SAMPLES_AT_EACH_POINT pulses so most of the samples come from slow mode
+    The estimate is the mean absolute change, a plain average for the first NOISE_FLOOR_MIN_SAMPLES then an IIR filter
+    The filter runs on a 32 bit accumulator so that small changes and a small estimate are not lost to truncation
+  */
+  unsigned int reverse_power;
+  unsigned int change;
+
+  reverse_power = global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
+
+  if ((bank->noise_previous_reverse_power != 0) &&
+      (global_data_A37434.motor_moved_during_pulse == 0) &&
+      (PositionDelta(global_data_A37434.position_at_trigger, bank->noise_previous_position) < MINIMUM_POSITION_CHANGE)) {
+    change = ETMMath16Delta(reverse_power, bank->noise_previous_reverse_power);
+    if (change > 0x0FFF) {
+      change = 0x0FFF;
+    }
+    change <<= 4;
+    
+    if (bank->noise_samples < NOISE_FLOOR_MIN_SAMPLES) {
+      bank->noise_samples++;
+      bank->noise_estimate = ((unsigned long)bank->noise_estimate * (bank->noise_samples - 1) + change) / bank->noise_samples;
+      if (bank->noise_samples == NOISE_FLOOR_MIN_SAMPLES) {
+	// Start the filter from the plain average
+	bank->noise_accumulator = (unsigned long)bank->noise_estimate << NOISE_FLOOR_FILTER_SHIFT;
+      }
+    } else {
+      bank->noise_accumulator -= (bank->noise_accumulator >> NOISE_FLOOR_FILTER_SHIFT);
+      bank->noise_accumulator += change;
+      bank->noise_estimate = bank->noise_accumulator >> NOISE_FLOOR_FILTER_SHIFT;
+    }
+  }
+  
+  bank->noise_previous_reverse_power = reverse_power;
+  bank->noise_previous_position = global_data_A37434.position_at_trigger;
+}
+
+
+unsigned int MinimumReversePowerChange(TYPE_POWER_READINGS* bank) {
+  /*
+    Reverse power changes smaller than this are too close to call
+    Uses the noise floor estimate once it has enough samples, the fixed bands before that
+  */
+  unsigned long threshold;
+  
+  if (bank->noise_samples >= NOISE_FLOOR_MIN_SAMPLES) {
+    threshold = ((unsigned long)bank->noise_estimate * NOISE_FLOOR_THRESHOLD_MULTIPLE) >> 8;
+    if (threshold < NOISE_FLOOR_MIN_THRESHOLD) {
+      threshold = NOISE_FLOOR_MIN_THRESHOLD;
+    }
+    if (threshold > 0xFFFF) {
+      threshold = 0xFFFF;
+    }
+    return threshold;
+  }
+
+  if (global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated < 11000) {
+    return MINIMUM_REV_PWR_CHANGE_11K_MINUS;
+  } else if (global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated < 16000) {
+    return MINIMUM_REV_PWR_CHANGE_11K_16K;
+  } else {
+    return MINIMUM_REV_PWR_CHANGE_16K_PLUS;
+  }
+}
+
+
+unsigned int CalculateDirection(unsigned long current_pos, unsigned long previous_pos, unsigned int current_rev_pwr, unsigned int previous_rev_pwr, unsigned int minimum_rev_power_change) {
+  
+  if ((previous_pos == 0) || (previous_rev_pwr == 0)) {
+    // The buffer is empty (or bad reading) and has no data in it so skip this comp.
+    return MOVE_NO_DATA;
+  }
+  
+  if ((PositionAdd(current_pos, MINIMUM_POSITION_CHANGE) > previous_pos) && (PositionSub(current_pos, MINIMUM_POSITION_CHANGE) < previous_pos)) {
+    // The positions are very close
+    return MOVE_NO_DATA;
+  } 
+  
+  if ((ETMMath16Add(current_rev_pwr, minimum_rev_power_change) > previous_rev_pwr) && (ETMMath16Sub(current_rev_pwr, minimum_rev_power_change) < previous_rev_pwr)) {
+    // The reverse power readings are very close
+    return MOVE_NO_DATA;
+  }
+  
+  if (current_pos > previous_pos) {
+    if (current_rev_pwr < previous_rev_pwr) {
+      // We need to go up more
+      return MOVE_UP;
     } else {
       // We need to go down
       return MOVE_DOWN;
@@ -576,17 +1454,456 @@ unsigned int CalculateDirection(unsigned int current_pos, unsigned int previous_
 
 
 void DoAFCCooldown(void) {
-  unsigned int position_difference;
-  unsigned int shift_position;
+  unsigned long position_difference;
+  unsigned long shift_position;
+  unsigned long target_position;
+  unsigned long time_off;
+  unsigned int cool_down_scale;
+
+  time_off = global_data_A37434.time_off_counter;
+  if (run_notice.active) {
+    // Use the position for the announced first pulse, the magnetron keeps cooling until then
+    time_off += run_notice.time_to_start;
+    if (time_off > LIMIT_RECORDED_OFF_TIME) {
+      time_off = LIMIT_RECORDED_OFF_TIME;
+    }
+  }
+
+  cool_down_scale = CoolDownValue(time_off >> 9);
 
   if (afc_motor.home_position > global_data_A37434.afc_hot_position) {
-    position_difference = ETMMath16Sub(afc_motor.home_position, global_data_A37434.afc_hot_position);
-    shift_position = ETMScaleFactor2(position_difference, CoolDownTable[global_data_A37434.time_off_counter >> 9], 0);
-    afc_motor.target_position = ETMMath16Sub(afc_motor.home_position, shift_position);
+    position_difference = PositionSub(afc_motor.home_position, global_data_A37434.afc_hot_position);
+    shift_position = PositionScaleQ15(position_difference, cool_down_scale);
+    target_position = PositionSub(afc_motor.home_position, shift_position);
+  } else {
+    position_difference = PositionSub(global_data_A37434.afc_hot_position, afc_motor.home_position); 
+    shift_position = PositionScaleQ15(position_difference, cool_down_scale);
+    target_position = PositionAdd(afc_motor.home_position, shift_position);
+  }
+
+  // Fast mode will start from the best known position near the cooldown position
+  SetMotorTarget(PowerMapSeed(target_position));
+
+  if (run_notice.active && !run_notice.banks_preloaded) {
+    // Fast mode starts from the pre-position without the readings left over from the last run
+    ClearPowerReadings();
+    run_notice.banks_preloaded = 1;
+  }
+}
+
+
+void RunNoticeStart(unsigned int prf, unsigned int energy_mode, unsigned int time_to_start) {
+  /*
+    The ECB announces the next run before the first pulse
+    DoAFCCooldown() moves the tuner to where the cooldown will be at the announced start time
+    and clears the power banks there, so fast mode starts from the pre-position.
+    The announced PRF is loaded into the pulse sync history so the guard window is used from the second pulse.
+  */
+  unsigned int interval;
+  unsigned int n;
+
+  if (global_data_A37434.time_off_counter < PULSE_SYNC_MAX_INTERVAL) {
+    // The linac is pulsing, a notice is only used between runs
+    return;
+  }
+
+  if (energy_mode <= ENERGY_CLASSIFY_FORWARD_POWER) {
+    energy_classifier.mode = energy_mode;
+  }
+
+  run_notice.active = 1;
+  run_notice.prf = prf;
+  run_notice.time_to_start = time_to_start;
+  run_notice.late_time = 0;
+  run_notice.banks_preloaded = 0;
+
+  // The pulse sync data is used by _INT0Interrupt, hold off INT0 while it is changed
+  _INT0IE = 0;
+  pulse_sync.preloaded = 0;
+  if (prf >= RUN_NOTICE_MIN_PRF) {
+    interval = TMR2_US_TO_TICKS(1000000 / prf);
+    for (n = 0; n < PULSE_SYNC_INTERVAL_HISTORY; n++) {
+      pulse_sync.interval[n] = interval;
+    }
+    pulse_sync.predicted_interval = interval;
+    pulse_sync.valid_intervals = 0;
+    pulse_sync.preloaded = 1;
+  }
+  _INT0IE = 1;
+}
+
+
+void RunNoticeTick(void) {
+  // Called every 10mS
+  if (!run_notice.active) {
+    return;
+  }
+  if (run_notice.time_to_start) {
+    run_notice.time_to_start--;
+    return;
+  }
+  run_notice.late_time++;
+  if (run_notice.late_time >= RUN_NOTICE_LATE_LIMIT) {
+    // The announced run did not start, go back to the normal cooldown
+    RunNoticeEnd();
+  }
+}
+
+
+void RunNoticeEnd(void) {
+  run_notice.active = 0;
+  _INT0IE = 0;
+  pulse_sync.preloaded = 0;
+  _INT0IE = 1;
+}
+
+
+unsigned int PowerMapBin(unsigned long position) {
+  /*
+    The map covers POWER_MAP_BINS bins centered on the home position
+    Returns POWER_MAP_NO_BIN if the position is outside the map
+  */
+  unsigned long map_start;
+  unsigned long offset;
+
+  map_start = PositionSub(afc_motor.home_position, POSITION_FROM_32NDS((unsigned long)POWER_MAP_BINS << (POWER_MAP_BIN_SHIFT - 1)));
+  if (position < map_start) {
+    return POWER_MAP_NO_BIN;
+  }
+  offset = POSITION_TO_32NDS(position - map_start) >> POWER_MAP_BIN_SHIFT;
+  if (offset >= POWER_MAP_BINS) {
+    return POWER_MAP_NO_BIN;
+  }
+  return offset;
+}
+
+
+void PowerMapRecordPulse(void) {
+  /*
+    Adds the latest pulse to the bin at the trigger position
+    Pulses where the motor moved do not have a reliable position and are not used
+  */
+  unsigned int bin;
+  unsigned int reverse_power;
+  unsigned int filter_weight;
+  
+  if (global_data_A37434.motor_moved_during_pulse) {
+    return;
+  }
+  bin = PowerMapBin(global_data_A37434.position_at_trigger);
+  if (bin == POWER_MAP_NO_BIN) {
+    return;
+  }
+
+  reverse_power = global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
+  filter_weight = power_map.weight[bin];
+  if (filter_weight > POWER_MAP_FILTER_WEIGHT) {
+    filter_weight = POWER_MAP_FILTER_WEIGHT;
+  }
+  if (reverse_power > power_map.reverse_power[bin]) {
+    power_map.reverse_power[bin] += (reverse_power - power_map.reverse_power[bin]) / (filter_weight + 1);
+  } else {
+    power_map.reverse_power[bin] -= (power_map.reverse_power[bin] - reverse_power) / (filter_weight + 1);
+  }
+  if (power_map.weight[bin] < POWER_MAP_MAX_WEIGHT) {
+    power_map.weight[bin]++;
+  }
+  power_map.seeded = 0;
+}
+
+
+void PowerMapTick(void) {
+  // Called every 10mS, the map slowly forgets bins that are not pulsed in
+  unsigned int n;
+
+  power_map.decay_timer++;
+  if (power_map.decay_timer < POWER_MAP_DECAY_TIME) {
+    return;
+  }
+  power_map.decay_timer = 0;
+  for (n = 0; n < POWER_MAP_BINS; n++) {
+    if (power_map.weight[n]) {
+      power_map.weight[n] -= (power_map.weight[n] >> 3) + 1;
+    }
+  }
+}
+
+
+unsigned long PowerMapSeed(unsigned long position) {
+  /*
+    Returns position moved to the lowest reverse power bin within POWER_MAP_SEED_BINS of it
+    The position is only moved if that bin is lower by POWER_MAP_MIN_DIFFERENCE, or if the map knows nothing about the starting bin
+    Only bins within POWER_MAP_MIN_DIFFERENCE of the map minimum are used, a known bin far from the resonance is not a better start
+  */
+  unsigned int bin;
+  unsigned int best_bin;
+  unsigned int best_power;
+  unsigned int near_minimum;
+  unsigned int n;
+
+  bin = PowerMapBin(position);
+  best_bin = PowerMapBestBin();
+  if ((bin == POWER_MAP_NO_BIN) || (best_bin == POWER_MAP_NO_BIN)) {
+    return position;
+  }
+  near_minimum = ETMMath16Add(power_map.reverse_power[best_bin], POWER_MAP_MIN_DIFFERENCE);
+
+  best_bin = bin;
+  best_power = 0xFFFF;
+  if (power_map.weight[bin] >= POWER_MAP_MIN_WEIGHT) {
+    best_power = ETMMath16Sub(power_map.reverse_power[bin], POWER_MAP_MIN_DIFFERENCE);
+  }
+  for (n = ((bin > POWER_MAP_SEED_BINS) ? (bin - POWER_MAP_SEED_BINS) : 0); (n <= (bin + POWER_MAP_SEED_BINS)) && (n < POWER_MAP_BINS); n++) {
+    if ((n != bin) && (power_map.weight[n] >= POWER_MAP_MIN_WEIGHT) &&
+	(power_map.reverse_power[n] <= near_minimum) && (power_map.reverse_power[n] < best_power)) {
+      best_bin = n;
+      best_power = power_map.reverse_power[n];
+    }
+  }
+
+  if (best_bin == bin) {
+    return position;
+  }
+  if (!power_map.seeded) {
+    power_map.seeded = 1;
+    power_map.seed_count++;
+  }
+  if (best_bin > bin) {
+    return PositionAdd(position, POSITION_FROM_32NDS((unsigned long)(best_bin - bin) << POWER_MAP_BIN_SHIFT));
+  }
+  return PositionSub(position, POSITION_FROM_32NDS((unsigned long)(bin - best_bin) << POWER_MAP_BIN_SHIFT));
+}
+
+
+unsigned int PowerMapDirection(unsigned long position) {
+  /*
+    Returns the direction of the lower of the two bins either side of position
+    MOVE_NO_DATA if the map does not know both of them or they are too close to call
+  */
+  unsigned int bin;
+  unsigned int below;
+  unsigned int above;
+
+  bin = PowerMapBin(position);
+  if ((bin == POWER_MAP_NO_BIN) || (bin == 0) || (bin >= (POWER_MAP_BINS - 1))) {
+    return MOVE_NO_DATA;
+  }
+  if ((power_map.weight[bin - 1] < POWER_MAP_MIN_WEIGHT) || (power_map.weight[bin + 1] < POWER_MAP_MIN_WEIGHT)) {
+    return MOVE_NO_DATA;
+  }
+  below = power_map.reverse_power[bin - 1];
+  above = power_map.reverse_power[bin + 1];
+  if (ETMMath16Add(below, POWER_MAP_MIN_DIFFERENCE) <= above) {
+    return MOVE_DOWN;
+  }
+  if (ETMMath16Add(above, POWER_MAP_MIN_DIFFERENCE) <= below) {
+    return MOVE_UP;
+  }
+  return MOVE_NO_DATA;
+}
+
+
+unsigned int PowerMapBestBin(void) {
+  // The lowest reverse power bin in the map, POWER_MAP_NO_BIN if the map is empty
+  unsigned int best_bin;
+  unsigned int best_power;
+  unsigned int n;
+
+  best_bin = POWER_MAP_NO_BIN;
+  best_power = 0xFFFF;
+  for (n = 0; n < POWER_MAP_BINS; n++) {
+    if ((power_map.weight[n] >= POWER_MAP_MIN_WEIGHT) && (power_map.reverse_power[n] < best_power)) {
+      best_bin = n;
+      best_power = power_map.reverse_power[n];
+    }
+  }
+  return best_bin;
+}
+
+
+unsigned long PowerMapBestPosition(void) {
+  // Center of the lowest reverse power bin in the map, 0 if the map is empty
+  unsigned int best_bin;
+
+  best_bin = PowerMapBestBin();
+  if (best_bin == POWER_MAP_NO_BIN) {
+    return 0;
+  }
+  return PositionAdd(PositionSub(afc_motor.home_position, POSITION_FROM_32NDS((unsigned long)POWER_MAP_BINS << (POWER_MAP_BIN_SHIFT - 1))),
+		     POSITION_FROM_32NDS(((unsigned long)best_bin << POWER_MAP_BIN_SHIFT) + (1 << (POWER_MAP_BIN_SHIFT - 1))));
+}
+
+
+void PowerMapClear(void) {
+  // The bins are placed relative to the home position, they do not apply once it has moved
+  unsigned int n;
+
+  for (n = 0; n < POWER_MAP_BINS; n++) {
+    power_map.reverse_power[n] = 0;
+    power_map.weight[n] = 0;
+  }
+  power_map.decay_timer = 0;
+  power_map.seeded = 0;
+}
+
+
+void ScanStart(void) {
+  /*
+    The scan moves to start_position, then sweeps to end_position at scan.speed 1/32 steps every 10mS.
+    Every pulse during the sweep is binned by position.
+    When the sweep is complete the average reverse and forward power for each bin is sent over CAN
+    followed by the bin with the lowest reverse power, which is the suggested home position.
+  */
+  unsigned int n;
+  unsigned long range;
+  
+  scan.requested = 0;
+  scan.phase = SCAN_PHASE_SEEK;
+  
+  if (scan.start_position < afc_motor.min_position) {
+    scan.start_position = afc_motor.min_position;
+  }
+  if (scan.start_position > afc_motor.max_position) {
+    scan.start_position = afc_motor.max_position;
+  }
+  if (scan.end_position < afc_motor.min_position) {
+    scan.end_position = afc_motor.min_position;
+  }
+  if (scan.end_position > afc_motor.max_position) {
+    scan.end_position = afc_motor.max_position;
+  }
+  if (scan.speed == 0) {
+    scan.speed = SCAN_DEFAULT_SPEED;
+  }
+  
+  if (scan.start_position < scan.end_position) {
+    scan.low_position = scan.start_position;
   } else {
-    position_difference = ETMMath16Sub(global_data_A37434.afc_hot_position, afc_motor.home_position); 
-    shift_position = ETMScaleFactor2(position_difference, CoolDownTable[global_data_A37434.time_off_counter >> 9], 0);
-    afc_motor.target_position = ETMMath16Add(afc_motor.home_position, shift_position);
+    scan.low_position = scan.end_position;
+  }
+  range = PositionDelta(scan.start_position, scan.end_position);
+  scan.bin_width = (range / SCAN_BINS) + 1;
+
+  for (n = 0; n < SCAN_BINS; n++) {
+    scan.reverse_power_total[n] = 0;
+    scan.forward_power_total[n] = 0;
+    scan.sample_count[n] = 0;
+  }
+  scan.report_index = 0;
+  scan.suggested_home_position = afc_motor.home_position;
+  
+  SetMotorTarget(scan.start_position);
+}
+
+
+void DoScanTick(void) {
+  // Called every 10mS while in STATE_SCAN
+  unsigned long target_position;
+
+  switch (scan.phase) {
+    
+  case SCAN_PHASE_SEEK:
+    SetMotorTarget(scan.start_position);
+    if (GetMotorPosition() == scan.start_position) {
+      scan.phase = SCAN_PHASE_SWEEP;
+    }
+    break;
+    
+  case SCAN_PHASE_SWEEP:
+    if (scan.end_position > scan.start_position) {
+      target_position = PositionAdd(afc_motor.target_position, POSITION_FROM_32NDS(scan.speed));
+      if (target_position > scan.end_position) {
+	target_position = scan.end_position;
+      }
+    } else {
+      target_position = PositionSub(afc_motor.target_position, POSITION_FROM_32NDS(scan.speed));
+      if (target_position < scan.end_position) {
+	target_position = scan.end_position;
+      }
+    }
+    SetMotorTarget(target_position);
+    if (GetMotorPosition() == scan.end_position) {
+      ScanCalculateResult();
+      scan.phase = SCAN_PHASE_REPORT;
+    }
+    break;
+    
+  case SCAN_PHASE_REPORT:
+    // Send one bin each 10mS so that the scan does not flood the CAN bus
+    if (scan.report_index < SCAN_BINS) {
+      if (scan.sample_count[scan.report_index]) {
+	ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_SCAN_CURVE,
+				scan.report_index,
+				POSITION_TO_32NDS(scan.low_position + scan.report_index * scan.bin_width + (scan.bin_width >> 1)),
+				scan.reverse_power_total[scan.report_index] / scan.sample_count[scan.report_index],
+				scan.forward_power_total[scan.report_index] / scan.sample_count[scan.report_index]);
+      }
+      scan.report_index++;
+    } else {
+      ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_SCAN_CURVE,
+			      SCAN_REPORT_SUMMARY_INDEX,
+			      POSITION_TO_32NDS(scan.suggested_home_position),
+			      scan.minimum_bin,
+			      POSITION_TO_32NDS(afc_motor.home_position));
+      scan.phase = SCAN_PHASE_DONE;
+    }
+    break;
+    
+  default:
+    scan.phase = SCAN_PHASE_DONE;
+    break;
+  }
+}
+
+
+void ScanRecordSample(void) {
+  unsigned int bin;
+
+  if (scan.phase != SCAN_PHASE_SWEEP) {
+    return;
+  }
+  
+  if (global_data_A37434.motor_moved_during_pulse) {
+    // The position of this sample is not certain
+    return;
+  }
+
+  if (global_data_A37434.position_at_trigger < scan.low_position) {
+    return;
+  }
+  
+  bin = (global_data_A37434.position_at_trigger - scan.low_position) / scan.bin_width;
+  if (bin >= SCAN_BINS) {
+    return;
+  }
+  
+  if (scan.sample_count[bin] < 0xFFFF) {
+    scan.reverse_power_total[bin] += global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
+    scan.forward_power_total[bin] += global_data_A37434.forward_power_sample.reading_scaled_and_calibrated;
+    scan.sample_count[bin]++;
+  }
+}
+
+
+void ScanCalculateResult(void) {
+  unsigned int n;
+  unsigned int average;
+  unsigned int minimum;
+
+  minimum = 0xFFFF;
+  scan.minimum_bin = SCAN_REPORT_SUMMARY_INDEX;
+  for (n = 0; n < SCAN_BINS; n++) {
+    if (scan.sample_count[n]) {
+      average = scan.reverse_power_total[n] / scan.sample_count[n];
+      if (average < minimum) {
+	minimum = average;
+	scan.minimum_bin = n;
+      }
+    }
+  }
+
+  if (scan.minimum_bin != SCAN_REPORT_SUMMARY_INDEX) {
+    scan.suggested_home_position = scan.low_position + scan.minimum_bin * scan.bin_width + (scan.bin_width >> 1);
   }
 }
 
@@ -605,41 +1922,71 @@ void ADCTriggerINT0(void) {
 
 
 void DoA37434(void) {
+  unsigned int n;
+
   ETMCanSlaveDoCan();
 
   if (_T3IF) {
     _T3IF = 0;
 
-    global_data_A37434.startup_delay++;
+    if (global_data_A37434.startup_delay < 0xFFFF) {
+      global_data_A37434.startup_delay++;
+    }
     
     // -------------- Update Logging Data ---------------- //
     slave_board_data.log_data[0] = 0;
-    slave_board_data.log_data[1] = afc_motor.target_position;
-    slave_board_data.log_data[2] = afc_motor.current_position;
-    slave_board_data.log_data[11] = afc_motor.home_position;
+    slave_board_data.log_data[1] = POSITION_TO_32NDS(afc_motor.target_position);
+    slave_board_data.log_data[2] = POSITION_TO_32NDS(GetMotorPosition());
+    slave_board_data.log_data[3] = global_data_A37434.outlier_pulse_count;
+    slave_board_data.log_data[4] = drive.fault_count;
+    slave_board_data.log_data[7] = DriveSpeedLevels[drive.speed_level];
+    slave_board_data.log_data[8] = global_data_A37434.ready_time;
+    slave_board_data.log_data[9] = POSITION_TO_32NDS(PowerMapBestPosition());
+    slave_board_data.log_data[10] = power_map.seed_count;
+    slave_board_data.log_data[12] = power_map.tie_break_count;
+    slave_board_data.log_data[11] = POSITION_TO_32NDS(afc_motor.home_position);
     slave_board_data.log_data[5] = global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
     slave_board_data.log_data[6] = global_data_A37434.forward_power_sample.reading_scaled_and_calibrated;
 
     
     UpdateFaults();
+    DriveManagerTick();
     MCP4725UpdateFast(&U13_MCP4725, test_value);
     test_value += 0x0010;
 
 
     // Update the "Hot Position" - This is where the motor ended when we stopped pulsing
     if (global_data_A37434.fast_afc_done == 1) {
-      global_data_A37434.afc_hot_position = afc_motor.current_position;
+      global_data_A37434.afc_hot_position = GetMotorPosition();
     }
 
+    RunNoticeTick();
+    PowerMapTick();
+
     // Update the time_off_counter and run the cooldown if needed
     if (global_data_A37434.time_off_counter < LIMIT_RECORDED_OFF_TIME) {
       global_data_A37434.time_off_counter++;
     }
 
+    // Time in AFC mode without a pulse, for the idle re-zero
+    if (global_data_A37434.control_state != STATE_RUN_AFC) {
+      rezero.idle_time = 0;
+    } else if (rezero.idle_time < REZERO_IDLE_TIME) {
+      rezero.idle_time++;
+    }
+
+    // TMR2 can not time a gap this long, throw away the pulse prediction
+    if (global_data_A37434.time_off_counter >= PULSE_SYNC_MAX_INTERVAL) {
+      pulse_sync.valid_intervals = 0;
+    }
+
     if (global_data_A37434.time_off_counter >= NO_PULSE_TIME_TO_INITITATE_COOLDOWN) {
       global_data_A37434.fast_afc_done = 0;
       global_data_A37434.pulses_on_this_run = 0;
       global_data_A37434.time_on_this_run = 0;
+      for (n = 0; n < AFC_ENERGY_BANKS; n++) {
+	power_readings[n].pulses_since_seen = ENERGY_BANK_TIMEOUT_PULSES;
+      }
       // Do not perform the cooldown in manual mode
       if (global_data_A37434.control_state == STATE_RUN_AFC) {
 	DoAFCCooldown();	
@@ -648,6 +1995,21 @@ void DoA37434(void) {
       }  
     }
 
+    // Save changed records while the magnetron is not pulsing so the I2C access can not delay a pulse
+    if ((global_data_A37434.time_off_counter >= RECORD_STORE_IDLE_TIME) && (global_data_A37434.control_state != STATE_SCAN)) {
+      RecordStoreDoIdle();
+    }
+
+    if (global_data_A37434.control_state == STATE_SCAN) {
+      DoScanTick();
+    } else {
+      TelemetryTick();
+    }
+
+    if (global_data_A37434.control_state == STATE_RUN_AFC) {
+      AFCStrategyTick();
+    }
+
     global_data_A37434.time_on_this_run++;
     /*
     ETMCanSlaveSetDebugRegister(0x0, ADCBUF0);
@@ -673,14 +2035,17 @@ void DoA37434(void) {
 
 
     ETMCanSlaveSetDebugRegister(0x0, global_data_A37434.control_state);
-    ETMCanSlaveSetDebugRegister(0x1, global_data_A37434.manual_target_position);
-    ETMCanSlaveSetDebugRegister(0x2, afc_motor.current_position);
-    ETMCanSlaveSetDebugRegister(0x3, afc_motor.target_position);
-    ETMCanSlaveSetDebugRegister(0x4, afc_motor.home_position);
+    ETMCanSlaveSetDebugRegister(0x1, POSITION_TO_32NDS(global_data_A37434.manual_target_position));
+    ETMCanSlaveSetDebugRegister(0x2, POSITION_TO_32NDS(GetMotorPosition()));
+    ETMCanSlaveSetDebugRegister(0x3, POSITION_TO_32NDS(afc_motor.target_position));
+    ETMCanSlaveSetDebugRegister(0x4, POSITION_TO_32NDS(afc_motor.home_position));
 
 
     ETMCanSlaveSetDebugRegister(0x5, global_data_A37434.sample_index);
-    ETMCanSlaveSetDebugRegister(0x6, global_data_A37434.test_trigger_received);
+    ETMCanSlaveSetDebugRegister(0x6, power_readings[0].noise_estimate);
+    ETMCanSlaveSetDebugRegister(0x7, pulse_sync.predicted_interval);
+    ETMCanSlaveSetDebugRegister(0x8, global_data_A37434.moved_pulse_count);
+    ETMCanSlaveSetDebugRegister(0x9, afc_motor.backlash_steps);
 				
     
     ETMCanSlaveSetDebugRegister(0xA, global_data_A37434.a_adc_reading_external);
@@ -717,6 +2082,56 @@ void UpdateFaults(void) {
 
 
 
+void __attribute__((interrupt, no_auto_psv)) _INT0Interrupt(void) {
+  unsigned int trigger_time;
+  unsigned int interval;
+
+  /*
+    INT0 is the pulse trigger.  The internal ADC conversion is started by INT0 in hardware.
+    This interrupt latches the motor position at the trigger and time stamps the pulse.
+    The time between triggers is used to predict when the next pulse will arrive so that _T1Interrupt can hold the motor still.
+  */
+
+  trigger_time = TMR2;
+
+  global_data_A37434.position_at_trigger = afc_motor.published_position[afc_motor.published_index];
+  global_data_A37434.motor_moved_during_pulse = 0;
+  if ((unsigned int)(trigger_time - pulse_sync.last_step_time) < TMR2_US_TO_TICKS(PULSE_SYNC_GUARD_BEFORE_US)) {
+    global_data_A37434.motor_moved_during_pulse = 1;
+  }
+
+  if (pulse_sync.preloaded) {
+    // First pulse of an announced run, there is no previous trigger but the history already holds the announced interval
+    pulse_sync.preloaded = 0;
+    pulse_sync.valid_intervals = PULSE_SYNC_MIN_VALID_INTERVALS - 1;
+  } else {
+    interval = trigger_time - pulse_sync.trigger_time;
+    if (interval <= (TMR2_US_TO_TICKS(PULSE_SYNC_GUARD_BEFORE_US) << 1)) {
+      // The pulses are too close together to fit a guard window between them
+      pulse_sync.valid_intervals = 0;
+    } else {
+      if (ETMMath16Delta(interval, pulse_sync.predicted_interval) <= (pulse_sync.predicted_interval >> 3)) {
+	if (pulse_sync.valid_intervals < PULSE_SYNC_MIN_VALID_INTERVALS) {
+	  pulse_sync.valid_intervals++;
+	}
+      } else {
+	pulse_sync.valid_intervals = 0;
+      }
+      pulse_sync.interval_index++;
+      pulse_sync.interval_index &= (PULSE_SYNC_INTERVAL_HISTORY - 1);
+      pulse_sync.interval[pulse_sync.interval_index] = interval;
+      PulseSyncUpdatePrediction();
+    }
+  }
+
+  pulse_sync.trigger_time = trigger_time;
+  pulse_sync.trigger_latched = 1;
+  pulse_sync.sample_pending = 1;
+
+  _INT0IF = 0;
+}
+
+
 void __attribute__((interrupt, no_auto_psv)) _INT1Interrupt(void) {
   unsigned long adc_read;
 
@@ -725,7 +2140,11 @@ void __attribute__((interrupt, no_auto_psv)) _INT1Interrupt(void) {
      INT0 Triggers the Internal ADC Conversion
   */
 
-  global_data_A37434.position_at_trigger = afc_motor.current_position;
+  if (pulse_sync.trigger_latched == 0) {
+    // INT0 was not received for this pulse, latch the position here
+    global_data_A37434.position_at_trigger = afc_motor.published_position[afc_motor.published_index];
+    global_data_A37434.motor_moved_during_pulse = 0;
+  }
   
   __delay32(80);  // wait 8us to pulse to terminate
   
@@ -741,85 +2160,472 @@ void __attribute__((interrupt, no_auto_psv)) _INT1Interrupt(void) {
   if (adc_read == 0x11110000) {
     global_data_A37434.a_adc_reading_external = 0;
   } else {
-    global_data_A37434.a_adc_reading_external = adc_read & 0xFFFF;
+    global_data_A37434.a_adc_reading_external = adc_read & 0xFFFF;
+  }
+  PIN_INPUT_A_CS = !OLL_SELECT_ADC;
+  
+  Nop();
+  Nop();
+
+  // Read back the "B" input ADC
+  PIN_INPUT_B_CS = OLL_SELECT_ADC;
+  adc_read = SendAndReceiveSPI(0, ETM_SPI_PORT_2);
+  if (adc_read == 0x11110000) {
+    global_data_A37434.b_adc_reading_external = 0;
+  } else {
+    global_data_A37434.b_adc_reading_external = adc_read & 0xFFFF;
+  }
+  PIN_INPUT_B_CS = !OLL_SELECT_ADC;  
+  
+  if (afc_motor.published_position[afc_motor.published_index] != global_data_A37434.position_at_trigger) {
+    global_data_A37434.motor_moved_during_pulse = 1;
+  }
+  pulse_sync.trigger_latched = 0;
+  pulse_sync.sample_pending = 0;
+
+  global_data_A37434.sample_index = ETMCanSlaveGetPulseCount();
+  global_data_A37434.sample_complete = 1;
+
+  //Dparker test
+  global_data_A37434.test_trigger_received++;
+  
+  _INT1IF = 0;
+}
+
+
+void __attribute__((interrupt, no_auto_psv)) _T1Interrupt(void) {
+  /*
+    The T1 interrupt controls the motor movent
+    The maximum speed of the motor is 1/MOTOR_MICROSTEPS_PER_STEP step per _T1 interrupt
+    The maximum speed of the motor is set by setting the time of the _T1 interrupt 
+
+    The motor is held still in a guard window around the predicted pulse and until the pulse has been sampled.
+    It is also held while DriveManagerTick has the driver in reset.
+    After a hold the move carries on at the speed it had, the time spent holding is not made up.
+  */
+  unsigned int moved;
+  unsigned int psvpag_save;
+
+  _T1IF = 0;
+  moved = 0;
+
+  // Ensure that the target position is a valid value
+  if (afc_motor.target_position > afc_motor.max_position) {
+    afc_motor.target_position = afc_motor.max_position;
+  }
+  if (afc_motor.target_position < afc_motor.min_position) {
+    afc_motor.target_position = afc_motor.min_position;
+  }
+    
+  if (afc_motor.current_position == afc_motor.target_position) {
+    // We are at our target position
+    afc_motor.time_steps_stopped++;
+  } else if (drive.reset_timer) {
+    // nRESET is low and the driver outputs are off, do not count steps the motor can not make
+    afc_motor.time_steps_stopped++;
+  } else if (PulseSyncHoldMotor()) {
+    // We need to move but a pulse is due, wait until after the pulse
+    afc_motor.time_steps_stopped = 0;
+  } else {
+    afc_motor.time_steps_stopped = 0;
+    moved = 1;
+    if (afc_motor.current_position > afc_motor.target_position) {
+      // Move the motor one position
+      StepMotor(MOVE_DOWN);
+    } else {
+      // Move the motor one position the other direction
+      StepMotor(MOVE_UP);
+    }
+    pulse_sync.last_step_time = TMR2;
+  }
+
+  if ((unsigned int)(TMR2 - pulse_sync.last_step_time) > TMR2_US_TO_TICKS(PULSE_SYNC_GUARD_BEFORE_US)) {
+    // Keep last_step_time from rolling over and looking like a recent step
+    pulse_sync.last_step_time = TMR2 - TMR2_US_TO_TICKS(PULSE_SYNC_GUARD_BEFORE_US);
+  }
+
+  DriveUpdate(moved);
+  
+  // The PWM tables are in program memory, this ISR is no_auto_psv so PSVPAG is set here
+  psvpag_save = PSVPAG;
+  PSVPAG = AFC_TABLE_PSV_PAGE;
+
+  if (afc_motor.time_steps_stopped >= DELAY_SWITCH_TO_LOW_POWER_MODE) {
+    // use the low power look up table
+    afc_motor.time_steps_stopped = DELAY_SWITCH_TO_LOW_POWER_MODE;
+    PDC1 = PWMTableValue(PWMLowPowerTable, ShiftIndex(afc_motor.drive_position,0));
+    PDC2 = PWMTableValue(PWMLowPowerTable, ShiftIndex(afc_motor.drive_position,(MOTOR_PWM_TABLE_SIZE/2)));
+    PDC3 = PWMTableValue(PWMLowPowerTable, ShiftIndex(afc_motor.drive_position,(MOTOR_PWM_TABLE_SIZE/4)));
+    PDC4 = PWMTableValue(PWMLowPowerTable, ShiftIndex(afc_motor.drive_position,(MOTOR_PWM_TABLE_SIZE*3/4)));
+  } else {
+    // use the high power lookup table
+    PDC1 = PWMTableValue(PWMHighPowerTable, ShiftIndex(afc_motor.drive_position,0));
+    PDC2 = PWMTableValue(PWMHighPowerTable, ShiftIndex(afc_motor.drive_position,(MOTOR_PWM_TABLE_SIZE/2)));
+    PDC3 = PWMTableValue(PWMHighPowerTable, ShiftIndex(afc_motor.drive_position,(MOTOR_PWM_TABLE_SIZE/4)));
+    PDC4 = PWMTableValue(PWMHighPowerTable, ShiftIndex(afc_motor.drive_position,(MOTOR_PWM_TABLE_SIZE*3/4)));
+  }
+
+  PSVPAG = psvpag_save;
+}
+
+void DriveInitialize(void) {
+  /*
+    Called from InitializeMotor before T1 is started
+    The cruise speed starts at the highest level that is not faster than MOTOR_SPEED
+    Promotion stops at the highest level that is not faster than DRIVE_MAX_SPEED
+  */
+  unsigned int level;
+
+  level = 0;
+  while (((level + 1) < DRIVE_SPEED_LEVELS) && (DriveSpeedLevels[level + 1] <= DRIVE_MAX_SPEED)) {
+    level++;
+  }
+  drive.max_speed_level = level;
+
+  level = 0;
+  while (((level + 1) < DRIVE_SPEED_LEVELS) && (DriveSpeedLevels[level + 1] <= MOTOR_SPEED)) {
+    level++;
+  }
+  drive.fault_count = 0;
+  drive.reset_timer = 0;
+  drive.moving = 0;
+  drive.direction = MOVE_DOWN;
+  DriveSetSpeedLevel(level);
+  drive.period = drive.start_period;
+  drive.phase = DRIVE_PHASE_HOLD;
+  DriveSetOutputs();
+}
+
+
+void DriveSetSpeedLevel(unsigned int level) {
+  // The periods are used by _T1Interrupt, hold off T1 while they are changed
+  unsigned int start_period;
+  unsigned int cruise_period;
+  unsigned int period_step;
+
+  start_period = PR1_FOR_SPEED(DRIVE_START_SPEED);
+  cruise_period = PR1_FOR_SPEED(DriveSpeedLevels[level]);
+  period_step = (start_period - cruise_period) / DRIVE_ACCEL_STEPS;
+  if (period_step == 0) {
+    period_step = 1;
+  }
+
+  _T1IE = 0;
+  drive.speed_level = level;
+  drive.start_period = start_period;
+  drive.cruise_period = cruise_period;
+  drive.period_step = period_step;
+  if (level >= DRIVE_FAST_DECAY_SPEED_LEVEL) {
+    drive.cruise_decay = DRIVE_DECAY_FAST;
+  } else {
+    drive.cruise_decay = DRIVE_DECAY_CRUISE;
+  }
+  if (drive.phase == DRIVE_PHASE_CRUISE) {
+    DriveSetOutputs();
+  }
+  _T1IE = 1;
+  drive.fault_free_move_time = 0;
+}
+
+
+void DriveUpdate(unsigned int moved) {
+  /*
+    Called from _T1Interrupt after the motor has (or has not) stepped
+    Sets the period of the next T1 interrupt and the driver current range and decay mode for the phase
+    A move starts at DRIVE_START_SPEED and the period is reduced by period_step every step until it reaches the cruise period
+    The ramp starts again after a reversal or after DRIVE_RESTART_STOPPED_PERIODS stopped at the target, not after a pulse sync hold
+  */
+  unsigned int phase;
+  unsigned int period;
+
+  if (moved) {
+    drive.moving = 1;
+    if (afc_motor.last_direction != drive.direction) {
+      drive.direction = afc_motor.last_direction;
+      drive.period = drive.start_period;
+    }
+    if (drive.period > (drive.cruise_period + drive.period_step)) {
+      drive.period -= drive.period_step;
+      phase = DRIVE_PHASE_ACCEL;
+    } else {
+      drive.period = drive.cruise_period;
+      phase = DRIVE_PHASE_CRUISE;
+    }
+    period = drive.period;
+  } else {
+    if (afc_motor.time_steps_stopped >= DRIVE_RESTART_STOPPED_PERIODS) {
+      // The motor has stopped, the next move starts from the start speed
+      drive.period = drive.start_period;
+    }
+    period = drive.cruise_period;
+    phase = drive.phase;
+    if (afc_motor.time_steps_stopped >= DELAY_SWITCH_TO_LOW_POWER_MODE) {
+      phase = DRIVE_PHASE_HOLD;
+    }
+  }
+
+  if (PR1 != period) {
+    PR1 = period;
+    if (TMR1 >= period) {
+      // The new period is shorter than the time already counted
+      TMR1 = 0;
+    }
+  }
+
+  if (phase != drive.phase) {
+    drive.phase = phase;
+    DriveSetOutputs();
+  }
+}
+
+
+void DriveSetOutputs(void) {
+  unsigned int iset;
+  unsigned int decay;
+
+  switch (drive.phase) {
+    
+  case DRIVE_PHASE_ACCEL:
+    iset = DRIVE_ISET_ACCEL;
+    decay = DRIVE_DECAY_ACCEL;
+    break;
+
+  case DRIVE_PHASE_CRUISE:
+    iset = DRIVE_ISET_CRUISE;
+    decay = drive.cruise_decay;
+    break;
+
+  default:
+    iset = DRIVE_ISET_HOLD;
+    decay = DRIVE_DECAY_HOLD;
+    break;
+  }
+
+  PIN_MOTOR_DRV_ISET_A0 = (iset & 0x0001);
+  PIN_MOTOR_DRV_ISET_B0 = (iset & 0x0001);
+  PIN_MOTOR_DRV_ISET_A1 = ((iset >> 1) & 0x0001);
+  PIN_MOTOR_DRV_ISET_B1 = ((iset >> 1) & 0x0001);
+
+  if (decay == DRIVE_DECAY_MIXED) {
+    TRIS_MOTOR_DRV_DECAY_SELECT = 1;
+  } else {
+    PIN_MOTOR_DRV_DECAY_SELECT = decay;
+    TRIS_MOTOR_DRV_DECAY_SELECT = 0;
+  }
+}
+
+
+void DriveManagerTick(void) {
+  /*
+    Called every 10mS
+    A driver fault (over current or over temperature) drops the cruise speed one level and limits it to that level.
+    The fault is cleared by pulsing nRESET.
+    After DRIVE_PROMOTE_MOVE_TIME of moving without a fault the next speed level is tried, up to max_speed_level.
+  */
+  unsigned int level;
+
+  if (drive.reset_timer) {
+    drive.reset_timer--;
+    if (drive.reset_timer == 0) {
+      PIN_MOTOR_DRV_RESET_NOT = 1;
+    }
+    return;
+  }
+
+  if (PIN_MOTOR_DRV_INPUT_NOT_FAULT == 0) {
+    _STATUS_MOTOR_DRIVE_FAULT = 1;
+    drive.fault_count++;
+    level = drive.speed_level;
+    if (level) {
+      level--;
+    }
+    drive.max_speed_level = level;
+    DriveSetSpeedLevel(level);
+    DriveLog();
+    PIN_MOTOR_DRV_RESET_NOT = 0;
+    drive.reset_timer = DRIVE_FAULT_RESET_TIME;
+    return;
+  }
+  _STATUS_MOTOR_DRIVE_FAULT = 0;
+
+  if (drive.moving) {
+    drive.moving = 0;
+    drive.fault_free_move_time++;
+    if ((drive.fault_free_move_time >= DRIVE_PROMOTE_MOVE_TIME) && (drive.speed_level < drive.max_speed_level)) {
+      DriveSetSpeedLevel(drive.speed_level + 1);
+      DriveLog();
+    }
+  }
+}
+
+
+void DriveLog(void) {
+  ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_TELEMETRY,
+			  TELEMETRY_INDEX_DRIVE,
+			  drive.fault_count,
+			  DriveSpeedLevels[drive.speed_level],
+			  (drive.max_speed_level << 8) + drive.phase);
+}
+
+
+void StepMotor(unsigned int direction) {
+  /*
+    Moves the motor one position
+    When the motor reverses, afc_motor.backlash_steps take up steps are made before current_position changes
+    If the motor reverses again part way through the take up, only the take up already made has to be undone
+  */
+  if (direction != afc_motor.last_direction) {
+    afc_motor.last_direction = direction;
+    afc_motor.backlash_remaining = ETMMath16Sub(afc_motor.backlash_steps, afc_motor.backlash_remaining);
+  }
+
+  if (direction == MOVE_UP) {
+    afc_motor.drive_position++;
+  } else {
+    afc_motor.drive_position--;
   }
-  PIN_INPUT_A_CS = !OLL_SELECT_ADC;
-  
-  Nop();
-  Nop();
 
-  // Read back the "B" input ADC
-  PIN_INPUT_B_CS = OLL_SELECT_ADC;
-  adc_read = SendAndReceiveSPI(0, ETM_SPI_PORT_2);
-  if (adc_read == 0x11110000) {
-    global_data_A37434.b_adc_reading_external = 0;
+  if (afc_motor.backlash_remaining) {
+    afc_motor.backlash_remaining--;
+  } else if (direction == MOVE_UP) {
+    afc_motor.current_position++;
+    PublishMotorPosition();
   } else {
-    global_data_A37434.b_adc_reading_external = adc_read & 0xFFFF;
+    afc_motor.current_position--;
+    PublishMotorPosition();
   }
-  PIN_INPUT_B_CS = !OLL_SELECT_ADC;  
-  
-  global_data_A37434.sample_index = ETMCanSlaveGetPulseCount();
-  global_data_A37434.sample_complete = 1;
+}
 
-  //Dparker test
-  global_data_A37434.test_trigger_received++;
-  
-  _INT1IF = 0;
+
+void PublishMotorPosition(void) {
+  /*
+    Called with T1 held off (or from _T1Interrupt) every time current_position changes
+    INT0 and INT1 have a higher priority than T1 and may run part way through this, so the copy that is
+    not in use is written and then made the published one with a single 16 bit write
+  */
+  unsigned int index;
+
+  index = afc_motor.published_index ^ 1;
+  afc_motor.published_position[index] = afc_motor.current_position;
+  afc_motor.published_index = index;
 }
 
 
-void __attribute__((interrupt, no_auto_psv)) _T1Interrupt(void) {
+unsigned int PulseSyncHoldMotor(void) {
   /*
-    The T1 interrupt controls the motor movent
-    The maximum speed of the motor is 1/32 step per _T1 interrupt
-    The maximum speed of the motor is set by setting the time of the _T1 interrupt 
+    Returns 1 if the motor should not step now
+    The motor is held from INT0 until INT1 has read back the sample
+    Once the pulse timing is stable, the motor is also held for PULSE_SYNC_GUARD_BEFORE_US before the predicted pulse
+    If the pulse is more than PULSE_SYNC_GUARD_LATE_US late the motor is released
   */
+  unsigned int elapsed;
 
-  _T1IF = 0;
+  elapsed = TMR2 - pulse_sync.trigger_time;
 
-  // Ensure that the target position is a valid value
-  if (afc_motor.target_position > afc_motor.max_position) {
-    afc_motor.target_position = afc_motor.max_position;
+  if (pulse_sync.sample_pending) {
+    if (elapsed < TMR2_US_TO_TICKS(PULSE_SYNC_SAMPLE_TIMEOUT_US)) {
+      return 1;
+    }
+    // INT1 never arrived
+    pulse_sync.sample_pending = 0;
   }
-  if (afc_motor.target_position < afc_motor.min_position) {
-    afc_motor.target_position = afc_motor.min_position;
+  
+  if (pulse_sync.valid_intervals < PULSE_SYNC_MIN_VALID_INTERVALS) {
+    return 0;
   }
-    
-  if (afc_motor.current_position > afc_motor.target_position) {
-    // Move the motor one position
-    afc_motor.time_steps_stopped = 0;
-    afc_motor.current_position--;
-  } else if (afc_motor.current_position < afc_motor.target_position) {
-    // Move the motor one position the other direction
-    afc_motor.time_steps_stopped = 0;
-    afc_motor.current_position++;
-  } else {
-    // We are at our target position
-    afc_motor.time_steps_stopped++;
+
+  if ((elapsed >= (pulse_sync.predicted_interval - TMR2_US_TO_TICKS(PULSE_SYNC_GUARD_BEFORE_US))) &&
+      (elapsed < (pulse_sync.predicted_interval + TMR2_US_TO_TICKS(PULSE_SYNC_GUARD_LATE_US)))) {
+    return 1;
   }
+
+  return 0;
+}
+
+
+void PulseSyncUpdatePrediction(void) {
+  unsigned long interval_total;
+  unsigned int n;
   
-  if (afc_motor.time_steps_stopped >= DELAY_SWITCH_TO_LOW_POWER_MODE) {
-    // use the low power look up table
-    afc_motor.time_steps_stopped = DELAY_SWITCH_TO_LOW_POWER_MODE;
-    PDC1 = PWMLowPowerTable[ShiftIndex(afc_motor.current_position,0)];
-    PDC2 = PWMLowPowerTable[ShiftIndex(afc_motor.current_position,64)];
-    PDC3 = PWMLowPowerTable[ShiftIndex(afc_motor.current_position,32)];
-    PDC4 = PWMLowPowerTable[ShiftIndex(afc_motor.current_position,96)];        
-  } else {
-    // use the high power lookup table
-    PDC1 = PWMHighPowerTable[ShiftIndex(afc_motor.current_position,0)];
-    PDC2 = PWMHighPowerTable[ShiftIndex(afc_motor.current_position,64)];
-    PDC3 = PWMHighPowerTable[ShiftIndex(afc_motor.current_position,32)];
-    PDC4 = PWMHighPowerTable[ShiftIndex(afc_motor.current_position,96)];        
+  interval_total = 0;
+  for (n = 0; n < PULSE_SYNC_INTERVAL_HISTORY; n++) {
+    interval_total += pulse_sync.interval[n];
   }
+  pulse_sync.predicted_interval = interval_total / PULSE_SYNC_INTERVAL_HISTORY;
 }
 
+
 unsigned int ShiftIndex(unsigned int index, unsigned int shift) {
   unsigned int value;
   value = index;
-  value &= 0x007F;
+  value &= (MOTOR_PWM_TABLE_SIZE - 1);
   value += shift;
-  value &= 0x007F;
+  value &= (MOTOR_PWM_TABLE_SIZE - 1);
+  return value;
+}
+
+
+unsigned int PWMTableValue(const unsigned int* quarter_table, unsigned int index) {
+  /*
+    Rebuilds the full PWM table from the stored quarter
+    index 0 to MOTOR_PWM_TABLE_SIZE/2 - 1 is the sine hump, mirrored about the peak plateau
+    index MOTOR_PWM_TABLE_SIZE/2 and above is the same as index 0
+    PSVPAG must already be set to AFC_TABLE_PSV_PAGE
+  */
+  unsigned int plateau;
+
+  if (index >= (MOTOR_PWM_TABLE_SIZE >> 1)) {
+    return quarter_table[0];
+  }
+  
+  plateau = index >> PWM_TABLE_PLATEAU_SHIFT;
+  if (plateau > PWM_QUARTER_TABLE_LAST) {
+    plateau = (PWM_QUARTER_TABLE_LAST << 1) - plateau;
+  }
+  return quarter_table[plateau];
+}
+
+
+unsigned int CoolDownValue(unsigned int index) {
+  /*
+    Returns the Q1.15 cooldown multiplier for index (5.12 second units)
+    Below 8 the knots are at every index, above that there are 4 knots per octave and the value is linearly interpolated
+  */
+  unsigned int octave;
+  unsigned int spacing_shift;
+  unsigned int knot;
+  unsigned int fraction;
+  unsigned int value;
+  unsigned int next_value;
+  unsigned int psvpag_save;
+
+  if (index >= COOL_DOWN_END_INDEX) {
+    return 0;
+  }
+
+  psvpag_save = PSVPAG;
+  PSVPAG = AFC_TABLE_PSV_PAGE;
+
+  if (index < 8) {
+    value = CoolDownKnots[index];
+  } else {
+    octave = 3;
+    while ((index >> (octave + 1)) && (octave < 15)) {
+      octave++;
+    }
+    spacing_shift = octave - 2;
+    knot = ((octave - 1) << 2) + ((index >> spacing_shift) & 0x0003);
+    fraction = index & ((1 << spacing_shift) - 1);
+    value = CoolDownKnots[knot];
+    next_value = CoolDownKnots[knot + 1];
+    if (value > next_value) {
+      value -= (unsigned int)(((unsigned long)(value - next_value) * fraction) >> spacing_shift);
+    } else {
+      value += (unsigned int)(((unsigned long)(next_value - value) * fraction) >> spacing_shift);
+    }
+  }
+
+  PSVPAG = psvpag_save;
   return value;
 }
 
@@ -848,30 +2654,123 @@ void ETMCanSlaveExecuteCMDBoardSpecific(ETMCanMessage* message_ptr) {
 	Place all board specific commands here
       */
     case ETM_CAN_REGISTER_AFC_SET_1_HOME_POSITION_AND_OFFSET:
-      afc_motor.home_position = message_ptr->word0;
+      if (POSITION_FROM_32NDS(message_ptr->word0) != afc_motor.home_position) {
+	PowerMapClear();
+      }
+      afc_motor.home_position = POSITION_FROM_32NDS(message_ptr->word0);
       _CONTROL_NOT_CONFIGURED = 0;
       break;
 
     case ETM_CAN_REGISTER_AFC_CMD_SELECT_AFC_MODE:
+      scan.phase = SCAN_PHASE_DONE;  // Selecting a mode aborts a scan
       _STATUS_AFC_MODE_MANUAL_MODE = 0;
       global_data_A37434.time_off_counter = LIMIT_RECORDED_OFF_TIME;  // Move us back to home position when we go back to AFC mode
       break;
 
     case ETM_CAN_REGISTER_AFC_CMD_SELECT_MANUAL_MODE:
+      scan.phase = SCAN_PHASE_DONE;  // Selecting a mode aborts a scan
       _STATUS_AFC_MODE_MANUAL_MODE = 1;
       break;
 
     case ETM_CAN_REGISTER_AFC_CMD_SET_MANUAL_TARGET_POSITION:
-      global_data_A37434.manual_target_position = message_ptr->word0;
+      // word0 is in 1/32 steps, word1 is the additional fine position when the resolution is finer than 1/32 step
+      global_data_A37434.manual_target_position = POSITION_FROM_32NDS(message_ptr->word0) + (message_ptr->word1 & POSITION_FINE_MASK);
+      break;
+
+    case ETM_CAN_REGISTER_AFC_CMD_SET_BACKLASH:
+      // word0 is the number of take up steps, word1 enables the online backlash estimate
+      afc_motor.backlash_steps = POSITION_FROM_32NDS(message_ptr->word0);
+      if (afc_motor.backlash_steps > BACKLASH_MAX_STEPS) {
+	afc_motor.backlash_steps = BACKLASH_MAX_STEPS;
+      }
+      backlash.estimate = afc_motor.backlash_steps;
+      backlash.auto_estimate = message_ptr->word1;
+      break;
+
+    case ETM_CAN_REGISTER_AFC_CMD_SET_ENERGY_MODE:
+      // word0 is the classification mode, word1 is the pattern or forward power threshold, word2 is the bank 1 weight
+      energy_classifier.mode = message_ptr->word0;
+      energy_classifier.parameter = message_ptr->word1;
+      if (message_ptr->word2 <= ENERGY_BANK_WEIGHT_TOTAL) {
+	energy_classifier.weight[1] = message_ptr->word2;
+	energy_classifier.weight[0] = ENERGY_BANK_WEIGHT_TOTAL - message_ptr->word2;
+      }
+      ClearPowerReadings();
+      break;
+
+    case ETM_CAN_REGISTER_AFC_CMD_START_SCAN:
+      // word0 is the start position, word1 is the end position (1/32 steps), word2 is the speed in 1/32 steps per 10mS
+      scan.start_position = POSITION_FROM_32NDS(message_ptr->word0);
+      scan.end_position = POSITION_FROM_32NDS(message_ptr->word1);
+      scan.speed = message_ptr->word2;
+      scan.requested = 1;
+      break;
+
+    case ETM_CAN_REGISTER_AFC_CMD_SET_POWER_CALIBRATION:
+      // word0 selects the input (0 reverse, 1 forward), word1 is the calibration scale (1 = 0x8000), word2 is the calibration offset
+      // The new calibration is used straight away and saved to the EEPROM the next time the magnetron is not pulsing
+      {
+	unsigned int calibration[RECORD_STORE_DATA_WORDS];
+	if (!RecordStoreRead(RECORD_ID_POWER_CALIBRATION, calibration)) {
+	  calibration[CALIBRATION_REVERSE_SCALE]  = MACRO_DEC_TO_CAL_FACTOR_2(1);
+	  calibration[CALIBRATION_REVERSE_OFFSET] = 0;
+	  calibration[CALIBRATION_FORWARD_SCALE]  = MACRO_DEC_TO_CAL_FACTOR_2(1);
+	  calibration[CALIBRATION_FORWARD_OFFSET] = 0;
+	}
+	if (message_ptr->word0 == 0) {
+	  calibration[CALIBRATION_REVERSE_SCALE]  = message_ptr->word1;
+	  calibration[CALIBRATION_REVERSE_OFFSET] = message_ptr->word2;
+	} else {
+	  calibration[CALIBRATION_FORWARD_SCALE]  = message_ptr->word1;
+	  calibration[CALIBRATION_FORWARD_OFFSET] = message_ptr->word2;
+	}
+	RecordStoreWrite(RECORD_ID_POWER_CALIBRATION, calibration);
+	LoadPowerCalibration();
+      }
+      break;
+
+    case ETM_CAN_REGISTER_AFC_CMD_TELEMETRY:
+      // word0 is the telemetry mode (or TELEMETRY_CMD_CLEAR), word1 is the stream period in 10mS units
+      if (message_ptr->word0 == TELEMETRY_CMD_CLEAR) {
+	TelemetryClearHistograms();
+	break;
+      }
+      telemetry.mode = message_ptr->word0;
+      telemetry.stream_period = message_ptr->word1;
+      if (telemetry.stream_period == 0) {
+	telemetry.stream_period = TELEMETRY_STREAM_PERIOD;
+      }
+      telemetry.stream_timer = 0;
+      telemetry.report_index = 0;
+      break;
+
+    case ETM_CAN_REGISTER_AFC_CMD_SELECT_STRATEGY:
+      // word0 is the fast mode strategy, word1 is the slow mode strategy, word2 is the shadow strategy (AFC_STRATEGY_NONE for off)
+      if ((message_ptr->word0 >= AFC_STRATEGIES) || (message_ptr->word1 >= AFC_STRATEGIES)) {
+	break;
+      }
+      if ((message_ptr->word2 >= AFC_STRATEGIES) && (message_ptr->word2 != AFC_STRATEGY_NONE)) {
+	break;
+      }
+      afc_strategy.fast_strategy = message_ptr->word0;
+      afc_strategy.slow_strategy = message_ptr->word1;
+      afc_strategy.shadow_strategy = message_ptr->word2;
+      AFCShadowInitialize();
+      ClearPowerReadings();
+      break;
+
+    case ETM_CAN_REGISTER_AFC_CMD_RUN_NOTICE:
+      // word0 is the PRF in Hz, word1 is the energy classification mode (RUN_NOTICE_ENERGY_MODE_UNCHANGED to keep it), word2 is the time to the first pulse in 10mS units
+      RunNoticeStart(message_ptr->word0, message_ptr->word1, message_ptr->word2);
       break;
 
     case ETM_CAN_REGISTER_AFC_CMD_RELATIVE_MOVE_MANUAL_TARGET:
       if (message_ptr->word1) {
 	// decrease the target position;
-	global_data_A37434.manual_target_position = ETMMath16Sub(global_data_A37434.manual_target_position, message_ptr->word0);
+	global_data_A37434.manual_target_position = PositionSub(global_data_A37434.manual_target_position, POSITION_FROM_32NDS(message_ptr->word0));
       } else {
 	// increase the target position;
-	global_data_A37434.manual_target_position = ETMMath16Add(global_data_A37434.manual_target_position, message_ptr->word0);
+	global_data_A37434.manual_target_position = PositionAdd(global_data_A37434.manual_target_position, POSITION_FROM_32NDS(message_ptr->word0));
       }
       break;
 
@@ -881,6 +2780,347 @@ void ETMCanSlaveExecuteCMDBoardSpecific(ETMCanMessage* message_ptr) {
     }
 }
 
+void LoadPowerCalibration(void) {
+  /*
+    Applies the calibration from the record store RAM copy to the power inputs
+    If there is no valid calibration record the inputs are left uncalibrated
+  */
+  unsigned int calibration[RECORD_STORE_DATA_WORDS];
+
+  if (!RecordStoreRead(RECORD_ID_POWER_CALIBRATION, calibration)) {
+    return;
+  }
+  
+  global_data_A37434.reverse_power_sample.calibration_external_scale  = calibration[CALIBRATION_REVERSE_SCALE];
+  global_data_A37434.reverse_power_sample.calibration_external_offset = calibration[CALIBRATION_REVERSE_OFFSET];
+  global_data_A37434.forward_power_sample.calibration_external_scale  = calibration[CALIBRATION_FORWARD_SCALE];
+  global_data_A37434.forward_power_sample.calibration_external_offset = calibration[CALIBRATION_FORWARD_OFFSET];
+}
+
+unsigned int RezeroDue(void) {
+  /*
+    The cooldown is finished after REZERO_IDLE_TIME in AFC mode without a pulse
+    The motor is at home and not expected to move, so this is the time to re-reference it
+    time_off_counter is not used because selecting AFC mode sets it to LIMIT_RECORDED_OFF_TIME
+  */
+  if (!REZERO_ENABLE) {
+    return 0;
+  }
+  if (rezero.done_this_idle) {
+    return 0;
+  }
+  if (rezero.idle_time < REZERO_IDLE_TIME) {
+    return 0;
+  }
+  if (run_notice.active && (run_notice.time_to_start < RUN_NOTICE_REZERO_TIME)) {
+    // The tuner would not be back at the pre-position in time for the announced run
+    return 0;
+  }
+  return 1;
+}
+
+
+void RezeroStart(void) {
+  /*
+    The re-zero works like STATE_AUTO_ZERO at boot but starts from the current position
+    SEEK moves down to AFC_MOTOR_END_STOP_POSITION (the end stop reference from STATE_AUTO_ZERO) with normal steps
+    A motor that has not lost steps does not touch the end stop before then, so the count stays valid if SEEK is aborted
+    OVERTRAVEL then drives REZERO_OVERTRAVEL further so the motor stalls against the end stop even if steps were lost
+    RETURN starts with the count at AFC_MOTOR_END_STOP_POSITION at the end stop and moves back to where the motor was
+
+    There is no sensor at the end stop, so the number of lost steps can not be measured.
+    The count of re-zeros and how each one ended are logged.
+  */
+  rezero.done_this_idle = 1;
+  rezero.phase = REZERO_PHASE_SEEK;
+  rezero.return_position = afc_motor.target_position;
+  SetMotorLimits(AFC_MOTOR_END_STOP_POSITION, AFC_MOTOR_MAX_POSITION);
+  SetMotorTarget(AFC_MOTOR_END_STOP_POSITION);
+}
+
+
+unsigned int DoRezero(void) {
+  // Returns 1 when the re-zero is complete
+  switch (rezero.phase) {
+
+  case REZERO_PHASE_SEEK:
+    if (GetMotorPosition() == AFC_MOTOR_END_STOP_POSITION) {
+      // The target stays at the end stop position, the motor is driven REZERO_OVERTRAVEL further down
+      SetMotorPosition(PositionAdd(AFC_MOTOR_END_STOP_POSITION, REZERO_OVERTRAVEL));
+      rezero.phase = REZERO_PHASE_OVERTRAVEL;
+    }
+    break;
+
+  case REZERO_PHASE_OVERTRAVEL:
+    if (GetMotorPosition() == AFC_MOTOR_END_STOP_POSITION) {
+      // The motor is against the end stop and the count is back at the end stop position
+      SetMotorTarget(rezero.return_position);
+      SetMotorLimits(AFC_MOTOR_MIN_POSITION, AFC_MOTOR_MAX_POSITION);
+      rezero.phase = REZERO_PHASE_RETURN;
+    }
+    break;
+
+  case REZERO_PHASE_RETURN:
+    if (GetMotorPosition() == rezero.return_position) {
+      rezero.count++;
+      rezero.phase = REZERO_PHASE_DONE;
+      RezeroLog();
+      return 1;
+    }
+    break;
+
+  default:
+    return 1;
+  }
+  return 0;
+}
+
+
+void RezeroAbort(void) {
+  /*
+    Stops the re-zero where it is
+    During OVERTRAVEL the count has been moved, the best estimate is that the motor has already reached the end stop
+  */
+  if (rezero.phase == REZERO_PHASE_OVERTRAVEL) {
+    SetMotorPosition(AFC_MOTOR_END_STOP_POSITION);
+  }
+  SetMotorTarget(GetMotorPosition());
+  SetMotorLimits(AFC_MOTOR_MIN_POSITION, AFC_MOTOR_MAX_POSITION);
+  rezero.abort_count++;
+  RezeroLog();
+  rezero.phase = REZERO_PHASE_DONE;
+}
+
+
+void RezeroLog(void) {
+  ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_TELEMETRY,
+			  TELEMETRY_INDEX_REZERO,
+			  rezero.count,
+			  rezero.abort_count,
+			  rezero.phase);
+}
+
+
+void SetMotorPosition(unsigned long position) {
+  // current_position is 32 bits and is updated by _T1Interrupt, hold off T1 while it is changed
+  _T1IE = 0;
+  afc_motor.current_position = position;
+  afc_motor.backlash_remaining = 0;
+  PublishMotorPosition();
+  _T1IE = 1;
+}
+
+
+void TelemetryRecordPulse(void) {
+  /*
+    Adds this pulse to the histograms and the summary of the current run
+    A run starts with the first pulse and ends when the cooldown starts
+  */
+  unsigned long position;
+  unsigned long difference;
+  unsigned int reverse_power;
+  unsigned int bin;
+  unsigned int direction;
+
+  position = global_data_A37434.position_at_trigger;
+  reverse_power = global_data_A37434.reverse_power_sample.reading_scaled_and_calibrated;
+
+  if (!telemetry.run_active) {
+    telemetry.run_active = 1;
+    telemetry.this_run.pulses = 0;
+    telemetry.this_run.pulses_to_lock = 0;
+    telemetry.this_run.direction_reversals = 0;
+    telemetry.this_run.fast_mode_time = 0;
+    telemetry.this_run.reverse_power_integral = 0;
+    telemetry.previous_position = position;
+    telemetry.previous_target = afc_motor.target_position;
+    telemetry.previous_direction = MOVE_NO_DATA;
+  }
+  
+  // Power histograms
+  bin = reverse_power >> HISTOGRAM_POWER_SHIFT;
+  if (bin >= HISTOGRAM_BINS) {
+    bin = HISTOGRAM_BINS - 1;
+  }
+  if (telemetry.histogram[HISTOGRAM_REVERSE_POWER][bin] < 0xFFFF) {
+    telemetry.histogram[HISTOGRAM_REVERSE_POWER][bin]++;
+  }
+
+  bin = global_data_A37434.forward_power_sample.reading_scaled_and_calibrated >> HISTOGRAM_POWER_SHIFT;
+  if (bin >= HISTOGRAM_BINS) {
+    bin = HISTOGRAM_BINS - 1;
+  }
+  if (telemetry.histogram[HISTOGRAM_FORWARD_POWER][bin] < 0xFFFF) {
+    telemetry.histogram[HISTOGRAM_FORWARD_POWER][bin]++;
+  }
+
+  // Position error relative to home, half the bins each side
+  difference = PositionDelta(position, afc_motor.home_position) >> MOTOR_MICROSTEP_SHIFT >> HISTOGRAM_POSITION_SHIFT;
+  if (difference > ((HISTOGRAM_BINS >> 1) - 1)) {
+    difference = (HISTOGRAM_BINS >> 1) - 1;
+  }
+  if (position >= afc_motor.home_position) {
+    bin = (HISTOGRAM_BINS >> 1) + difference;
+  } else {
+    bin = ((HISTOGRAM_BINS >> 1) - 1) - difference;
+  }
+  if (telemetry.histogram[HISTOGRAM_POSITION_ERROR][bin] < 0xFFFF) {
+    telemetry.histogram[HISTOGRAM_POSITION_ERROR][bin]++;
+  }
+
+  // Step size - log2 of the movement since the previous pulse
+  difference = PositionDelta(position, telemetry.previous_position);
+  bin = 0;
+  while (difference && (bin < (HISTOGRAM_BINS - 1))) {
+    difference >>= 1;
+    bin++;
+  }
+  if (telemetry.histogram[HISTOGRAM_STEP_SIZE][bin] < 0xFFFF) {
+    telemetry.histogram[HISTOGRAM_STEP_SIZE][bin]++;
+  }
+  telemetry.previous_position = position;
+
+  // Run summary
+  if (telemetry.this_run.pulses < 0xFFFF) {
+    telemetry.this_run.pulses++;
+  }
+  telemetry.this_run.reverse_power_integral += reverse_power;
+
+  if ((telemetry.this_run.pulses_to_lock == 0) && global_data_A37434.fast_afc_done) {
+    telemetry.this_run.pulses_to_lock = telemetry.this_run.pulses;
+  }
+
+  if (afc_motor.target_position != telemetry.previous_target) {
+    if (afc_motor.target_position > telemetry.previous_target) {
+      direction = MOVE_UP;
+    } else {
+      direction = MOVE_DOWN;
+    }
+    if ((telemetry.previous_direction != MOVE_NO_DATA) && (direction != telemetry.previous_direction)) {
+      telemetry.this_run.direction_reversals++;
+    }
+    telemetry.previous_direction = direction;
+    telemetry.previous_target = afc_motor.target_position;
+  }
+}
+
+
+void TelemetryTick(void) {
+  /*
+    Called every 10mS
+    Closes the run summary when the cooldown starts and sends the telemetry messages
+  */
+  if (telemetry.run_active) {
+    if (global_data_A37434.fast_afc_done == 0) {
+      telemetry.this_run.fast_mode_time++;
+    }
+    if (global_data_A37434.time_off_counter >= NO_PULSE_TIME_TO_INITITATE_COOLDOWN) {
+      telemetry.last_run = telemetry.this_run;
+      telemetry.run_active = 0;
+      telemetry.run_count++;
+    }
+  }
+
+  switch (telemetry.mode) {
+
+  case TELEMETRY_MODE_DUMP:
+    TelemetrySendMessage(telemetry.report_index);
+    telemetry.report_index++;
+    if (telemetry.report_index >= TELEMETRY_MESSAGES) {
+      telemetry.report_index = 0;
+      telemetry.mode = TELEMETRY_MODE_OFF;
+    }
+    break;
+
+  case TELEMETRY_MODE_STREAM:
+    telemetry.stream_timer++;
+    if (telemetry.stream_timer >= telemetry.stream_period) {
+      telemetry.stream_timer = 0;
+      TelemetrySendMessage(telemetry.report_index);
+      telemetry.report_index++;
+      if (telemetry.report_index >= TELEMETRY_MESSAGES) {
+	telemetry.report_index = 0;
+      }
+    }
+    break;
+
+  default:
+    telemetry.mode = TELEMETRY_MODE_OFF;
+    break;
+  }
+}
+
+
+void TelemetrySendMessage(unsigned int index) {
+  /*
+    Histogram messages - word0 is (histogram << 8) + first bin, followed by HISTOGRAM_BINS_PER_MESSAGE bin counts
+    Then two messages with the summary of the last completed run and two with the shadow strategy comparison
+  */
+  unsigned int histogram;
+  unsigned int bin;
+  unsigned int count[HISTOGRAM_BINS_PER_MESSAGE];
+  unsigned int n;
+
+  if (index < (HISTOGRAMS * HISTOGRAM_MESSAGES)) {
+    histogram = index / HISTOGRAM_MESSAGES;
+    bin = (index % HISTOGRAM_MESSAGES) * HISTOGRAM_BINS_PER_MESSAGE;
+    for (n = 0; n < HISTOGRAM_BINS_PER_MESSAGE; n++) {
+      if ((bin + n) < HISTOGRAM_BINS) {
+	count[n] = telemetry.histogram[histogram][bin + n];
+      } else {
+	count[n] = 0;
+      }
+    }
+    ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_TELEMETRY,
+			    (histogram << 8) + bin,
+			    count[0],
+			    count[1],
+			    count[2]);
+  } else if (index == (HISTOGRAMS * HISTOGRAM_MESSAGES)) {
+    ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_TELEMETRY,
+			    TELEMETRY_INDEX_RUN_SUMMARY_0,
+			    telemetry.last_run.pulses,
+			    telemetry.last_run.pulses_to_lock,
+			    telemetry.last_run.direction_reversals);
+  } else if (index == (HISTOGRAMS * HISTOGRAM_MESSAGES + 1)) {
+    ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_TELEMETRY,
+			    TELEMETRY_INDEX_RUN_SUMMARY_1,
+			    telemetry.last_run.reverse_power_integral >> 16,
+			    telemetry.last_run.reverse_power_integral,
+			    telemetry.last_run.fast_mode_time);
+  } else if (index == (HISTOGRAMS * HISTOGRAM_MESSAGES + 2)) {
+    ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_TELEMETRY,
+			    TELEMETRY_INDEX_SHADOW_0,
+			    afc_strategy.pulses_compared,
+			    afc_strategy.direction_agree,
+			    afc_strategy.direction_disagree);
+  } else {
+    // word1 is the mean target difference in 1/32 steps
+    n = 0;
+    if (afc_strategy.pulses_compared) {
+      n = afc_strategy.target_difference_total / afc_strategy.pulses_compared;
+    }
+    ETMCanSlaveLogPulseData(ETM_CAN_DATA_LOG_REGISTER_AFC_TELEMETRY,
+			    TELEMETRY_INDEX_SHADOW_1,
+			    n,
+			    afc_strategy.target_difference_max,
+			    (afc_strategy.fast_strategy << 8) + (afc_strategy.slow_strategy << 4) + (afc_strategy.shadow_strategy & 0x000F));
+  }
+}
+
+
+void TelemetryClearHistograms(void) {
+  unsigned int histogram;
+  unsigned int bin;
+
+  for (histogram = 0; histogram < HISTOGRAMS; histogram++) {
+    for (bin = 0; bin < HISTOGRAM_BINS; bin++) {
+      telemetry.histogram[histogram][bin] = 0;
+    }
+  }
+}
+
+
 unsigned int ETMMath16Delta(unsigned int value_1, unsigned int value_2) {
   if (value_1 > value_2) {
     return (value_1 - value_2);
@@ -888,3 +3128,58 @@ unsigned int ETMMath16Delta(unsigned int value_1, unsigned int value_2) {
     return (value_2 - value_1);
   }
 }
+
+
+unsigned long PositionAdd(unsigned long position, unsigned long delta) {
+  if ((0xFFFFFFFF - position) < delta) {
+    return 0xFFFFFFFF;
+  }
+  return (position + delta);
+}
+
+unsigned long PositionSub(unsigned long position, unsigned long delta) {
+  if (delta > position) {
+    return 0;
+  }
+  return (position - delta);
+}
+
+unsigned long PositionDelta(unsigned long position_1, unsigned long position_2) {
+  if (position_1 > position_2) {
+    return (position_1 - position_2);
+  } else {
+    return (position_2 - position_1);
+  }
+}
+
+unsigned long PositionScaleQ15(unsigned long position, unsigned int scale) {
+  // Returns position * scale / 2^15 without overflowing 32 bits
+  return (((position >> 15) * scale) + (((position & 0x7FFF) * scale) >> 15));
+}
+
+unsigned long GetMotorPosition(void) {
+  /*
+    current_position is 32 bits and is updated by _T1Interrupt
+    Read it until two reads agree so that the main loop never sees a half updated value
+  */
+  unsigned long position;
+  do {
+    position = afc_motor.current_position;
+  } while (position != afc_motor.current_position);
+  return position;
+}
+
+void SetMotorTarget(unsigned long position) {
+  // target_position is 32 bits and is used by _T1Interrupt, hold off T1 while it is changed
+  _T1IE = 0;
+  afc_motor.target_position = position;
+  _T1IE = 1;
+}
+
+void SetMotorLimits(unsigned long min_position, unsigned long max_position) {
+  // The limits are 32 bits and are used by _T1Interrupt, hold off T1 while they are changed
+  _T1IE = 0;
+  afc_motor.min_position = min_position;
+  afc_motor.max_position = max_position;
+  _T1IE = 1;
+}
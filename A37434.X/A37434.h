@@ -29,6 +29,7 @@
   I2C    - Used/Configured by EEPROM Module, DAC Module
 
   Timer1 - Used for timing motor steps
+  Timer2 - Free running, used to time stamp pulses and predict the next pulse
   Timer3 - Used for 10ms Generation
   ADC Module - See Below For Specifics
   Motor Control PWM Module - Used to control AFC stepper motor
@@ -71,6 +72,7 @@
 #define PIN_MOTOR_DRV_RESET_NOT          _LATD3
 #define PIN_MOTOR_DRV_SLEEP_NOT          _LATD2
 #define PIN_MOTOR_DRV_DECAY_SELECT       _LATD12
+#define TRIS_MOTOR_DRV_DECAY_SELECT      _TRISD12     // Set to an input for mixed decay
 
 #define PIN_MOTOR_DRV_ISET_A0            _LATC14
 #define PIN_MOTOR_DRV_ISET_A1            _LATC13
@@ -104,12 +106,44 @@
 #define MOTOR_PWM_FREQ                    20000        // Motor Drive Frequency is 10KHz
 #define DELAY_SWITCH_TO_LOW_POWER_MODE    200
 
+/*
+  Positions are unsigned long in units of 1/MOTOR_MICROSTEPS_PER_STEP step
+  Positions sent and received over CAN stay in units of 1/32 step so that the ECB does not need to know the resolution
+*/
+#if MOTOR_MICROSTEPS_PER_STEP == 32
+#define MOTOR_MICROSTEP_SHIFT             0
+#elif MOTOR_MICROSTEPS_PER_STEP == 64
+#define MOTOR_MICROSTEP_SHIFT             1
+#elif MOTOR_MICROSTEPS_PER_STEP == 128
+#define MOTOR_MICROSTEP_SHIFT             2
+#else
+#error "MOTOR_MICROSTEPS_PER_STEP must be 32, 64 or 128"
+#endif
+
+#define POSITION_FROM_32NDS(x)            ((unsigned long)(x) << MOTOR_MICROSTEP_SHIFT)
+#define POSITION_TO_32NDS(x)              ((unsigned int)((x) >> MOTOR_MICROSTEP_SHIFT))
+#define POSITION_FINE_MASK                ((1 << MOTOR_MICROSTEP_SHIFT) - 1)
+
+#define MOTOR_PWM_TABLE_SIZE              (MOTOR_MICROSTEPS_PER_STEP * 4)   // The PWM tables cover one electrical cycle (4 full steps)
+
 
 // --------------------- T1 Configuration -----
 // With 1:8 prescale the minimum 1/32 step time is 52ms or a minimum speed of .6 Steps/second
 
 #define T1CON_SETTING     (T1_ON & T1_IDLE_CON & T1_GATE_OFF & T1_PS_1_8 & T1_SYNC_EXT_OFF & T1_SOURCE_INT)
-#define PR1_SETTING  (unsigned int)(FCY_CLK / 32 / 8 / MOTOR_SPEED)
+#define PR1_FOR_SPEED(x)  (unsigned int)(FCY_CLK / MOTOR_MICROSTEPS_PER_STEP / 8 / (x))    // x is in full steps per second
+#define PR1_SETTING       PR1_FOR_SPEED(MOTOR_SPEED)
+
+
+/*
+   TMR2 Configuration
+   Timer2 - Free running time base used to time stamp the pulse trigger (INT0)
+   With 10Mhz Clock, x64 multiplier will yield 6.4uS per tick and a rollover every 419mS
+*/
+
+#define T2CON_VALUE                    (T2_ON & T2_IDLE_CON & T2_GATE_OFF & T2_PS_1_64 & T2_32BIT_MODE_OFF & T2_SOURCE_INT)
+#define PR2_VALUE                      0xFFFF
+#define TMR2_US_TO_TICKS(x)            (unsigned int)((FCY_CLK / 1000000)*(x)/64)
 
 
 /* 
@@ -174,12 +208,13 @@
 typedef struct {
   unsigned int sample_index;                     // this is the pulse number from the Pulse Sync board used for indexing fast log
   unsigned int control_state;                    // 
-  unsigned int manual_target_position;           // 
+  unsigned long manual_target_position;          // 
   unsigned int sample_complete;                  // Status bit to indicate that INT1 Interrupt has completed
 
   unsigned int fast_afc_done;                    // Status bit to indicate that AFC has switched to "slow" tracking mode
   unsigned int pulses_on_this_run;               // Number of pulses for this run
   unsigned int time_on_this_run;                 // used to exit fast afc mode
+  unsigned int fast_mode_reentry_count;          // Number of times a step disturbance sent slow mode back to fast mode
 
   // Forward and reverse power
   unsigned int a_adc_reading_internal;
@@ -190,12 +225,14 @@ typedef struct {
   AnalogInput  forward_power_sample;             // This is the foward power data - at the moment unscaled from the ADC reading
 
   // Cooldown Variables
-  unsigned int afc_hot_position;                 // This is part of the cooldown algorithm
+  unsigned long afc_hot_position;                // This is part of the cooldown algorithm
   unsigned long time_off_counter;                // This is used to count how long the linac has been not pulsing.  Part of cooldown
 
   // Fast AFC Variables
-  unsigned int no_decision_counter;              // This counts how many consecutive samples the AFC has been unable to figure out if it should go up or down
-  unsigned int position_at_trigger;
+  unsigned long position_at_trigger;             // Motor position latched by INT0 at the pulse trigger
+  unsigned int motor_moved_during_pulse;         // Set if the motor stepped inside the guard window around this pulse
+  unsigned int moved_pulse_count;                // Number of pulses where the motor stepped inside the guard window
+  unsigned int outlier_pulse_count;              // Number of pulses rejected by the outlier filter
 
 
   // Voltage monitors and housekeeping
@@ -204,7 +241,8 @@ typedef struct {
 
   unsigned int test_trigger_received;
 
-  unsigned int startup_delay;
+  unsigned int startup_delay;                    // 10mS units since power up, used for the configuration timeout
+  unsigned int ready_time;                       // 10mS units from power up to STATE_RUN_AFC
   
 } AFCControlData;
 
@@ -218,11 +256,18 @@ extern AFCControlData global_data_A37434;
 
 
 #define STATE_STARTUP       0x10
-#define STATE_WAIT_INIT     0x18
 #define STATE_AUTO_ZERO     0x20
 #define STATE_AUTO_HOME     0x30
 #define STATE_RUN_AFC       0x40
 #define STATE_RUN_MANUAL    0x50
+#define STATE_SCAN          0x60
+#define STATE_REZERO        0x70
+
+
+#define SCAN_PHASE_SEEK     0
+#define SCAN_PHASE_SWEEP    1
+#define SCAN_PHASE_REPORT   2
+#define SCAN_PHASE_DONE     3
 
 
 
@@ -230,22 +275,78 @@ extern AFCControlData global_data_A37434;
 
 
 typedef struct {
-  unsigned int current_position;
-  unsigned int target_position;
-  unsigned int home_position;
-  unsigned int max_position;
-  unsigned int min_position;
+  unsigned long current_position;
+  unsigned long target_position;
+  unsigned long home_position;
+  unsigned long max_position;
+  unsigned long min_position;
   //unsigned int pwm_table_index;
   unsigned int time_steps_stopped;
+
+  // Backlash take up - current_position is the logical (tuner) position, drive_position is the motor position
+  unsigned int drive_position;                   // Used to index the PWM tables, moves on every step including take up steps
+  unsigned int last_direction;                   // Direction of the last step MOVE_UP/MOVE_DOWN
+  unsigned int backlash_steps;                   // Number of take up steps added when the motor reverses
+  unsigned int backlash_remaining;               // Take up steps left before current_position moves again
+
+  // INT0/INT1 can interrupt _T1Interrupt part way through a change to current_position, they read these copies instead
+  unsigned long published_position[2];           // Copies of current_position, the one at published_index is complete
+  unsigned int published_index;
 } STEPPER_MOTOR;
 
 
+typedef struct {
+  unsigned int auto_estimate;                    // When set the estimate is applied to afc_motor.backlash_steps
+  unsigned int measuring;                        // A response measurement is in progress
+  unsigned int after_reversal;                   // The measurement in progress started at a reversal
+  unsigned int direction;                        // Direction the tuner has been moving
+  unsigned long previous_position;
+  unsigned long reference_position;              // Position where the measurement started
+  unsigned int reference_reverse_power;          // Reverse power where the measurement started
+  unsigned long steady_response_distance;        // Distance needed to see a response when not reversing
+  signed int   estimate;                         // Filtered backlash estimate in microsteps
+} TYPE_BACKLASH_ESTIMATOR;
+
+
+typedef struct {
+  unsigned int trigger_time;                     // TMR2 value at the most recent trigger
+  unsigned int interval[PULSE_SYNC_INTERVAL_HISTORY]; // Recent trigger to trigger intervals in TMR2 ticks
+  unsigned int interval_index;
+  unsigned int predicted_interval;               // Average of the recent intervals
+  unsigned int valid_intervals;                  // Number of consecutive intervals that agreed with the prediction
+  unsigned int trigger_latched;                  // Set by INT0 when it has latched the position for this pulse
+  unsigned int sample_pending;                   // Set by INT0, cleared when INT1 has read back the sample
+  unsigned int last_step_time;                   // TMR2 value when the motor last took a step
+  unsigned int preloaded;                        // The interval history was loaded from a run notice, the next trigger starts the run
+} TYPE_PULSE_SYNC;
+
+
+typedef struct {
+  unsigned int requested;                        // Set by the CAN command, the state machine will enter STATE_SCAN
+  unsigned int phase;
+  unsigned long start_position;
+  unsigned long end_position;
+  unsigned int speed;                            // 1/32 steps moved per 10mS while sweeping
+  unsigned long low_position;                    // Position at the start of bin 0
+  unsigned long bin_width;
+  unsigned long reverse_power_total[SCAN_BINS];
+  unsigned long forward_power_total[SCAN_BINS];
+  unsigned int  sample_count[SCAN_BINS];
+  unsigned int report_index;                     // Next bin to be sent over CAN
+  unsigned int minimum_bin;
+  unsigned long suggested_home_position;
+} TYPE_SCAN;
+
+
 typedef struct {
   // Fast AFC Storage
-  unsigned int position[16];
+  unsigned long position[16];
   unsigned int reverse_power[16];
   unsigned int forward_power[16];
   unsigned int active_index;
+  unsigned int no_decision_counter;              // This counts how many consecutive samples the AFC has been unable to figure out if it should go up or down
+  unsigned int uses_power_map;                   // The power map is learned from this energy, tied votes can be broken with it
+  unsigned int map_tie_break;                    // The last vote was decided by the power map
 
   // Slow AFC Storage
   unsigned long reading_accumulator;
@@ -254,12 +355,249 @@ typedef struct {
   unsigned int average_reverse_power_previous_sample;
   
   unsigned int  reading_count;
+  unsigned long previous_reading_accumulator;    // Sum of the reverse power over the previous dwell
+  unsigned int  previous_reading_count;          // Length of the previous dwell, 0 if there is no previous dwell to compare with
   unsigned int  current_movement_direction;
+
+  // Energy bank output
+  unsigned long target_position;                 // Where this bank would put the motor
+  unsigned int pulses_since_seen;                // Pulses since this bank was last used
+
+  // Fast to slow mode switch
+  unsigned int pulses_in_fast_mode;
+  unsigned int direction_history;                // One bit per fast mode vote, 1 = MOVE_UP
+  unsigned int converged;
+  unsigned int disturbance_count;                // Consecutive pulses well above the reference reverse power
+  unsigned int disturbance_reference;            // Average reverse power of the last slow mode dwell
+
+  // Outlier (arc / mis-fire) filter
+  unsigned int outlier_window[OUTLIER_WINDOW];   // Most recent reverse power readings, including outliers
+  unsigned int outlier_window_index;
+  unsigned int outlier_window_count;
+  unsigned int outlier_count;                    // Pulses from this bank rejected by the filter
+
+  // Noise floor estimate
+  unsigned long noise_previous_position;
+  unsigned int noise_previous_reverse_power;     // 0 if there is no previous reading
+  unsigned int noise_estimate;                   // Mean pulse to pulse change in reverse power at an unchanged position, 1/16 LSB units
+  unsigned int noise_samples;
+  unsigned long noise_accumulator;               // IIR filter state, noise_estimate << NOISE_FLOOR_FILTER_SHIFT with the fraction kept
 } TYPE_POWER_READINGS;
 
 
+/*
+  AFC strategy interface
+  A strategy moves bank->target_position in response to the pulses of one energy bank.
+  init is called whenever the bank is cleared (after ClearBankReadings), pulse for every pulse that passed the outlier filter,
+  tick every 10mS while in STATE_RUN_AFC (may be 0) and target returns the position the strategy wants for the bank.
+  A strategy used in fast mode must keep bank->direction_history up to date (1 bit per pulse, 1 = MOVE_UP) so that
+  CheckBankConverged can switch to slow mode, otherwise only the MAXIMUM_FAST_MODE_PULSES / MAXIMUM_FAST_MODE_TIME backstops end fast mode.
+*/
+typedef struct {
+  void (*init)(TYPE_POWER_READINGS* bank);
+  void (*pulse)(TYPE_POWER_READINGS* bank);
+  void (*tick)(TYPE_POWER_READINGS* bank);
+  unsigned long (*target)(TYPE_POWER_READINGS* bank);
+} TYPE_AFC_STRATEGY;
+
+#define AFC_STRATEGY_FAST_VOTE          0        // 15 pulse direction vote (original fast mode)
+#define AFC_STRATEGY_SLOW_DWELL         1        // Dwell and compare with the previous dwell (original slow mode)
+#define AFC_STRATEGIES                  2
+#define AFC_STRATEGY_NONE               0xFFFF   // Shadow strategy disabled
+
+typedef struct {
+  unsigned int fast_strategy;                    // Strategy used until fast mode is done
+  unsigned int slow_strategy;                    // Strategy used after fast mode is done
+  unsigned int shadow_strategy;                  // Runs on copies of the banks without moving the motor, AFC_STRATEGY_NONE if off
+  TYPE_POWER_READINGS shadow_readings[AFC_ENERGY_BANKS];
+
+  // Shadow compared with the live strategy, cleared when the selection changes
+  unsigned int pulses_compared;
+  unsigned long target_difference_total;         // Sum of |shadow target - live target| in 1/32 steps
+  unsigned int target_difference_max;            // 1/32 steps
+  unsigned int direction_agree;                  // Pulses where both targets moved the same way
+  unsigned int direction_disagree;               // Pulses where the targets moved in opposite directions
+} TYPE_AFC_STRATEGY_SELECT;
+
+
+typedef struct {
+  unsigned int pulses;
+  unsigned int pulses_to_lock;                   // Pulses before fast mode finished, 0 if it never did
+  unsigned int direction_reversals;              // Number of times the motor target changed direction
+  unsigned int fast_mode_time;                   // 10mS units spent in fast mode
+  unsigned long reverse_power_integral;          // Sum of the reverse power of every pulse
+} TYPE_RUN_SUMMARY;
+
+#define HISTOGRAM_REVERSE_POWER         0
+#define HISTOGRAM_FORWARD_POWER         1
+#define HISTOGRAM_POSITION_ERROR        2        // Position at the pulse relative to home, bin 8 is home to 1 step above
+#define HISTOGRAM_STEP_SIZE             3        // log2 of the motor movement between pulses, bin 0 is no movement
+#define HISTOGRAMS                      4
+#define HISTOGRAM_BINS                  16
+#define HISTOGRAM_BINS_PER_MESSAGE      3
+#define HISTOGRAM_MESSAGES              ((HISTOGRAM_BINS + HISTOGRAM_BINS_PER_MESSAGE - 1) / HISTOGRAM_BINS_PER_MESSAGE)
+#define TELEMETRY_MESSAGES              (HISTOGRAMS * HISTOGRAM_MESSAGES + 4)
+
+#define TELEMETRY_MODE_OFF              0
+#define TELEMETRY_MODE_DUMP             1        // Send every message once, one per 10mS
+#define TELEMETRY_MODE_STREAM           2        // Send one message every TELEMETRY_STREAM_PERIOD, repeating
+#define TELEMETRY_CMD_CLEAR             3        // Clear the histograms (command only)
+
+#define TELEMETRY_INDEX_RUN_SUMMARY_0   0xF000
+#define TELEMETRY_INDEX_RUN_SUMMARY_1   0xF001
+#define TELEMETRY_INDEX_REZERO          0xF002   // Sent when a re-zero finishes or is aborted
+#define TELEMETRY_INDEX_SHADOW_0        0xF003
+#define TELEMETRY_INDEX_SHADOW_1        0xF004
+#define TELEMETRY_INDEX_DRIVE           0xF005   // Sent when a driver fault changes the speed level or the level is raised
+
+typedef struct {
+  unsigned int histogram[HISTOGRAMS][HISTOGRAM_BINS];
+  TYPE_RUN_SUMMARY this_run;
+  TYPE_RUN_SUMMARY last_run;
+  unsigned int run_active;
+  unsigned int run_count;
+  unsigned long previous_position;
+  unsigned long previous_target;
+  unsigned int previous_direction;
+  unsigned int mode;
+  unsigned int stream_period;
+  unsigned int stream_timer;
+  unsigned int report_index;
+} TYPE_TELEMETRY;
+
+
+#define REZERO_PHASE_SEEK               0        // Normal move down to position 0
+#define REZERO_PHASE_OVERTRAVEL         1        // Drive REZERO_OVERTRAVEL further into the end stop
+#define REZERO_PHASE_RETURN             2        // Position 0 is now the end stop, go back to return_position
+#define REZERO_PHASE_DONE               3
+
+typedef struct {
+  unsigned int phase;
+  unsigned int done_this_idle;                   // Only one re-zero per idle period, cleared by the next pulse
+  unsigned long idle_time;                       // 10mS units in AFC mode since the last pulse
+  unsigned long return_position;
+  unsigned int count;                            // Completed re-zeros
+  unsigned int abort_count;                      // Re-zeros stopped because pulsing started again
+} TYPE_REZERO;
+
+
+#define POWER_MAP_NO_BIN                0xFFFF   // The position is outside the map
+
+typedef struct {
+  unsigned int reverse_power[POWER_MAP_BINS];    // Average reverse power of the recent pulses in each bin
+  unsigned int weight[POWER_MAP_BINS];           // One per pulse up to POWER_MAP_MAX_WEIGHT, decays with time
+  unsigned int decay_timer;
+  unsigned int seed_count;                       // Number of idle periods where the map moved the fast mode start
+  unsigned int seeded;                           // The map has moved the start for this idle period
+  unsigned int tie_break_count;                  // Tied fast mode votes decided by the map
+} TYPE_POWER_MAP;
+
+
+#define DRIVE_PHASE_HOLD                0        // Stopped for DELAY_SWITCH_TO_LOW_POWER_MODE
+#define DRIVE_PHASE_ACCEL               1        // Ramping up from DRIVE_START_SPEED after stopping or reversing
+#define DRIVE_PHASE_CRUISE              2
+
+// Driver current regulation level, ISET_x1 ISET_x0
+#define DRIVE_ISET_100_PERCENT          0
+#define DRIVE_ISET_71_PERCENT           1
+#define DRIVE_ISET_38_PERCENT           2
+
+#define DRIVE_DECAY_SLOW                0        // DECAY_SELECT low
+#define DRIVE_DECAY_FAST                1        // DECAY_SELECT high
+#define DRIVE_DECAY_MIXED               2        // DECAY_SELECT left open (pin set to an input)
+
+typedef struct {
+  unsigned int phase;
+  unsigned int direction;                        // Direction of the last step, a reversal restarts the ramp
+  unsigned int period;                           // T1 period for the next step
+  unsigned int start_period;                     // T1 period at DRIVE_START_SPEED
+  unsigned int cruise_period;                    // T1 period at the current speed level
+  unsigned int period_step;                      // Period reduction per step while accelerating
+  unsigned int cruise_decay;
+  unsigned int speed_level;                      // Index into DriveSpeedLevels
+  unsigned int max_speed_level;                  // Highest level allowed (DRIVE_MAX_SPEED), lowered by a driver fault
+  unsigned int moving;                           // Set by _T1Interrupt when the motor steps, cleared every 10mS
+  unsigned int fault_free_move_time;             // 10mS units moving at this level without a fault
+  unsigned int reset_timer;                      // nRESET is low while this is non zero
+  unsigned int fault_count;
+} TYPE_DRIVE_MANAGER;
+
+
+#define SLOW_DWELL_UNDECIDED            0
+#define SLOW_DWELL_BETTER               1        // Reverse power is lower than at the previous point
+#define SLOW_DWELL_WORSE                2
+
+
+#define ENERGY_CLASSIFY_NONE            0        // All pulses use bank 0
+#define ENERGY_CLASSIFY_PULSE_PARITY    1        // Odd pulses use bank 1
+#define ENERGY_CLASSIFY_CAN_PATTERN     2        // Bank is selected by a 16 pulse pattern from the ECB
+#define ENERGY_CLASSIFY_FORWARD_POWER   3        // Pulses with forward power at or above the threshold use bank 1
+
+typedef struct {
+  unsigned int mode;
+  unsigned int parameter;                        // Pattern for ENERGY_CLASSIFY_CAN_PATTERN, threshold for ENERGY_CLASSIFY_FORWARD_POWER
+  unsigned int weight[AFC_ENERGY_BANKS];         // Weight of each bank in the motor target, out of ENERGY_BANK_WEIGHT_TOTAL
+} TYPE_ENERGY_CLASSIFIER;
+
+
+#define RUN_NOTICE_ENERGY_MODE_UNCHANGED 0xFFFF  // Run notice word1 value that keeps the current energy classification
+
+typedef struct {
+  unsigned int active;                           // A run has been announced and has not started yet
+  unsigned int prf;                              // Announced PRF in Hz, 0 if it was not given
+  unsigned int time_to_start;                    // 10mS units until the announced first pulse
+  unsigned int late_time;                        // 10mS units since the announced first pulse
+  unsigned int banks_preloaded;                  // The power banks have been cleared at the pre-position
+} TYPE_RUN_NOTICE;
+
+
+// Board specific commands - These are not defined in the ETM CAN library
+#ifndef ETM_CAN_REGISTER_AFC_CMD_SET_BACKLASH
+#define ETM_CAN_REGISTER_AFC_CMD_SET_BACKLASH               0x5185
+#endif
+
+#ifndef ETM_CAN_REGISTER_AFC_CMD_SET_ENERGY_MODE
+#define ETM_CAN_REGISTER_AFC_CMD_SET_ENERGY_MODE            0x5187
+#endif
+
+#ifndef ETM_CAN_REGISTER_AFC_CMD_START_SCAN
+#define ETM_CAN_REGISTER_AFC_CMD_START_SCAN                 0x5186
+#endif
+
+#ifndef ETM_CAN_REGISTER_AFC_CMD_SET_POWER_CALIBRATION
+#define ETM_CAN_REGISTER_AFC_CMD_SET_POWER_CALIBRATION      0x5188
+#endif
+
+#ifndef ETM_CAN_REGISTER_AFC_CMD_TELEMETRY
+#define ETM_CAN_REGISTER_AFC_CMD_TELEMETRY                  0x5189
+#endif
+
+#ifndef ETM_CAN_REGISTER_AFC_CMD_SELECT_STRATEGY
+#define ETM_CAN_REGISTER_AFC_CMD_SELECT_STRATEGY            0x518A
+#endif
+
+#ifndef ETM_CAN_REGISTER_AFC_CMD_RUN_NOTICE
+#define ETM_CAN_REGISTER_AFC_CMD_RUN_NOTICE                 0x518B
+#endif
+
+// Pulse log registers for the AFC board in the ECB data log map (0x50 and 0x51 are AFC_FAST_LOG_0 and AFC_FAST_LOG_1)
+#ifndef ETM_CAN_DATA_LOG_REGISTER_AFC_SCAN_CURVE
+#define ETM_CAN_DATA_LOG_REGISTER_AFC_SCAN_CURVE            0x52
+#endif
+
+#ifndef ETM_CAN_DATA_LOG_REGISTER_AFC_TELEMETRY
+#define ETM_CAN_DATA_LOG_REGISTER_AFC_TELEMETRY             0x53
+#endif
+
+#define SCAN_REPORT_SUMMARY_INDEX                           0xFFFF  // First word of the scan log entry that carries the result
+
+
 #define _STATUS_AFC_MODE_MANUAL_MODE                    _LOGGED_STATUS_0
 #define _STATUS_AFC_AUTO_ZERO_HOME_IN_PROGRESS          _LOGGED_STATUS_1
+#define _STATUS_AFC_SCAN_IN_PROGRESS                    _LOGGED_STATUS_2
+#define _STATUS_RECORD_STORE_WRITE_FAILED               _LOGGED_STATUS_3
+#define _STATUS_MOTOR_DRIVE_FAULT                       _LOGGED_STATUS_4
+#define _STATUS_AFC_REZERO_IN_PROGRESS                  _LOGGED_STATUS_5  // Idle re-zero, does not set _CONTROL_NOT_READY (a pulse aborts it)
 // DPARKER - REALLY NEED TO UPDATE THE DOCUMENTATION
 
 #define _FAULT_CAN_COMMUNICATION_LATCHED                _LOGGED_FAULT_0
@@ -267,10 +605,43 @@ typedef struct {
 
 
 
-#define FULL_POWER_TABLE_VALUES 50,50,50,50,50,50,50,50,253,253,253,253,253,253,253,253,425,425,425,425,425,425,425,425,540,540,540,540,540,540,540,540,580,580,580,580,580,580,580,580,540,540,540,540,540,540,540,540,425,425,425,425,425,425,425,425,253,253,253,253,253,253,253,253,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50 
+/*
+  PWM tables
+  The full table covers one electrical cycle (MOTOR_PWM_TABLE_SIZE entries).  The first half is a sine hump and the second half is 50.
+  The hump is symmetric so only the first quarter is stored, one value per plateau (PWM_TABLE_PLATEAU microsteps)
+  The 1/32 tables have 1/4 step plateaus, the 1/64 and 1/128 tables are a smooth sine:
+  value = 50 + peak * sin(pi * index / (MOTOR_PWM_TABLE_SIZE/2))
+  See PWMTableValue() for how the full table is rebuilt
+  The values (A37434_TABLES.h) are generated by tools/generate_tables.py from the run / hold currents and PTPER
+*/
+#include "A37434_TABLES.h"
+
+#if MOTOR_MICROSTEPS_PER_STEP == 32
+#define PWM_TABLE_PLATEAU_SHIFT           3
+#define FULL_POWER_QUARTER_TABLE_VALUES   FULL_POWER_QUARTER_TABLE_VALUES_32
+#define LOW_POWER_QUARTER_TABLE_VALUES    LOW_POWER_QUARTER_TABLE_VALUES_32
+#elif MOTOR_MICROSTEPS_PER_STEP == 64
+#define PWM_TABLE_PLATEAU_SHIFT           0
+#define FULL_POWER_QUARTER_TABLE_VALUES   FULL_POWER_QUARTER_TABLE_VALUES_64
+#define LOW_POWER_QUARTER_TABLE_VALUES    LOW_POWER_QUARTER_TABLE_VALUES_64
+#else
+#define PWM_TABLE_PLATEAU_SHIFT           0
+#define FULL_POWER_QUARTER_TABLE_VALUES   FULL_POWER_QUARTER_TABLE_VALUES_128
+#define LOW_POWER_QUARTER_TABLE_VALUES    LOW_POWER_QUARTER_TABLE_VALUES_128
+#endif
+
+#define PWM_QUARTER_TABLE_LAST            ((MOTOR_PWM_TABLE_SIZE >> 2) >> PWM_TABLE_PLATEAU_SHIFT)  // Plateau at the peak of the sine
+#define PWM_QUARTER_TABLE_SIZE            (PWM_QUARTER_TABLE_LAST + 1)
+
 
-#define LOW_POWER_TABLE_VALUES 50,50,50,50,50,50,50,50,165,165,165,165,165,165,165,165,262,262,262,262,262,262,262,262,327,327,327,327,327,327,327,327,350,350,350,350,350,350,350,350,327,327,327,327,327,327,327,327,262,262,262,262,262,262,262,262,165,165,165,165,165,165,165,165,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50,50
+/*
+  Cooldown curve
+  The Q1.15 cooldown multiplier is stored at knots and linearly interpolated between them (see CoolDownValue())
+  Knots are at every index below 8 then 4 knots per octave (8,10,12,14,16,20,24,28,32,40 ... 224,256)
+  The interpolated curve is within 51/32768 of the thermal model
+  The multiplier is zero from COOL_DOWN_END_INDEX on (20 minutes)
+  The knots, COOL_DOWN_KNOTS and COOL_DOWN_END_INDEX are in A37434_TABLES.h, generated from the thermal time constants by tools/generate_tables.py
+*/
 
-#define COOL_DOWN_TABLE_VALUES 31130,31260,28985,27246,25880,24768,23833,23023,22303,21651,21052,20495,19972,19479,19012,18568,18146,17742,17357,16988,16635,16296,15972,15660,15361,15074,14798,14532,14277,14031,13794,13565,13345,13132,12927,12728,12536,12351,12171,11997,11828,11665,11506,11352,11202,11057,10916,10778,10644,10514,10387,10263,10142,10024,9908,9796,9686,9578,9473,9370,9269,9170,9073,8978,8884,8793,8703,8614,8528,8442,8359,8276,8195,8115,8037,7959,7883,7808,7734,7661,7589,7518,7448,7379,7311,7243,7177,7111,7047,6983,6919,6857,6795,6734,6674,6614,6555,6497,6439,6382,6326,6270,6215,6160,6106,6053,6000,5947,5895,5844,5793,5742,5693,5643,5594,5546,5498,5450,5403,5356,5310,5264,5219,5174,5130,5085,5042,4998,4956,4913,4871,4829,4788,4747,4706,4666,4626,4586,4547,4508,4470,4431,4394,4356,4319,4282,4245,4209,4173,4138,4102,4067,4033,3998,3964,3931,3897,3864,3831,3798,3766,3734,3702,3671,3639,3608,3578,3547,3517,3487,3457,3428,3399,3370,3341,3313,3285,3257,3229,3202,3174,3147,3121,3094,3068,3042,3016,2990,2965,2940,2915,2890,2865,2841,2817,2793,2769,2745,2722,2699,2676,2653,2631,2608,2586,2564,2542,2521,2499,2478,2457,2436,2416,2395,2375,2354,2334,2315,2295,2275,2256,2237,2218,2199,2180,2162,2143,2125,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
 
 #endif
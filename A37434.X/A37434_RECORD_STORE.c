@@ -0,0 +1,233 @@
+#include "A37434.h"
+#include "A37434_RECORD_STORE.h"
+
+TYPE_RECORD_STORE record_store;
+
+unsigned int RecordStoreCRC(unsigned int* page);
+unsigned int RecordStorePageNumber(unsigned int record_id, unsigned int slot);
+unsigned int RecordStoreSequenceNewer(unsigned int sequence_1, unsigned int sequence_2);
+unsigned int RecordStoreSave(unsigned int record_id);
+
+
+void RecordStoreInitialize(unsigned int eeprom_ok) {
+  unsigned int page[RECORD_STORE_PAGE_WORDS];
+  unsigned int record_id;
+  unsigned int slot;
+  unsigned int n;
+  TYPE_RECORD* record;
+
+  record_store.eeprom_ok = eeprom_ok;
+  record_store.write_count = 0;
+  record_store.write_failures = 0;
+  record_store.boot_crc_errors = 0;
+
+  for (record_id = 0; record_id < RECORD_STORE_RECORDS; record_id++) {
+    record = &record_store.record[record_id];
+    record->valid = 0;
+    record->dirty = 0;
+    record->failed_attempts = 0;
+    record->sequence = 0;
+    record->slot = RECORD_STORE_SLOTS_PER_RECORD - 1;  // The first save goes to slot 0
+
+    if (!eeprom_ok) {
+      continue;
+    }
+
+    for (slot = 0; slot < RECORD_STORE_SLOTS_PER_RECORD; slot++) {
+      ETMEEPromReadPage(RecordStorePageNumber(record_id, slot), page);
+
+      if (page[0] != ((RECORD_STORE_MAGIC << 8) | record_id)) {
+	// Never written (or belongs to something else) - not an error
+	continue;
+      }
+
+      if (page[RECORD_STORE_PAGE_WORDS - 1] != RecordStoreCRC(page)) {
+	// Torn or corrupted write, ignore this copy
+	record_store.boot_crc_errors++;
+	continue;
+      }
+
+      if (record->valid && !RecordStoreSequenceNewer(page[1], record->sequence)) {
+	continue;
+      }
+
+      record->valid = 1;
+      record->sequence = page[1];
+      record->slot = slot;
+      for (n = 0; n < RECORD_STORE_DATA_WORDS; n++) {
+	record->data[n] = page[n + 2];
+      }
+    }
+  }
+}
+
+
+unsigned int RecordStoreRead(unsigned int record_id, unsigned int* data) {
+  unsigned int n;
+
+  if (record_id >= RECORD_STORE_RECORDS) {
+    return 0;
+  }
+
+  if (!record_store.record[record_id].valid) {
+    return 0;
+  }
+
+  for (n = 0; n < RECORD_STORE_DATA_WORDS; n++) {
+    data[n] = record_store.record[record_id].data[n];
+  }
+  return 1;
+}
+
+
+void RecordStoreWrite(unsigned int record_id, unsigned int* data) {
+  unsigned int n;
+
+  if (record_id >= RECORD_STORE_RECORDS) {
+    return;
+  }
+
+  for (n = 0; n < RECORD_STORE_DATA_WORDS; n++) {
+    record_store.record[record_id].data[n] = data[n];
+  }
+  record_store.record[record_id].valid = 1;
+  record_store.record[record_id].dirty = 1;
+}
+
+
+unsigned int RecordStorePending(void) {
+  unsigned int record_id;
+
+  if (!record_store.eeprom_ok) {
+    return 0;
+  }
+  
+  for (record_id = 0; record_id < RECORD_STORE_RECORDS; record_id++) {
+    if (record_store.record[record_id].dirty) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+void RecordStoreDoIdle(void) {
+  unsigned int record_id;
+
+  if (!record_store.eeprom_ok) {
+    return;
+  }
+
+  for (record_id = 0; record_id < RECORD_STORE_RECORDS; record_id++) {
+    if (record_store.record[record_id].dirty) {
+      if (RecordStoreSave(record_id)) {
+	record_store.record[record_id].dirty = 0;
+      }
+      // Only one page write per call so that the caller is not held up
+      return;
+    }
+  }
+}
+
+
+unsigned int RecordStoreSave(unsigned int record_id) {
+  /*
+    Writes the RAM copy of the record to the slot after the current one and reads it back
+    If the read back does not match, the next slot is tried on the following call
+    The slot holding the previous copy is not written until every other slot has failed
+    Returns 1 if the record was saved
+  */
+  unsigned int page[RECORD_STORE_PAGE_WORDS];
+  unsigned int check[RECORD_STORE_PAGE_WORDS];
+  unsigned int slot;
+  unsigned int n;
+  TYPE_RECORD* record;
+
+  record = &record_store.record[record_id];
+
+  slot = record->slot + 1;
+  if (slot >= RECORD_STORE_SLOTS_PER_RECORD) {
+    slot = 0;
+  }
+  
+  page[0] = (RECORD_STORE_MAGIC << 8) | record_id;
+  page[1] = record->sequence + 1;
+  for (n = 0; n < RECORD_STORE_DATA_WORDS; n++) {
+    page[n + 2] = record->data[n];
+  }
+  page[RECORD_STORE_PAGE_WORDS - 1] = RecordStoreCRC(page);
+
+  record_store.write_count++;
+  ETMEEPromWritePage(RecordStorePageNumber(record_id, slot), page);
+  ETMEEPromReadPage(RecordStorePageNumber(record_id, slot), check);
+
+  for (n = 0; n < RECORD_STORE_PAGE_WORDS; n++) {
+    if (check[n] != page[n]) {
+      /*
+	The slot may be worn out.  Move past it so the next attempt uses the following slot.
+	The previous copy is still intact, so a reset now still boots with valid data.
+      */
+      record_store.write_failures++;
+      record->sequence = page[1];  // Do not reuse the sequence number in case the failed copy reads back later
+      record->slot = slot;
+      record->failed_attempts++;
+      if (record->failed_attempts >= (RECORD_STORE_SLOTS_PER_RECORD - 1)) {
+	// Every other slot has failed, stop trying to save this record
+	record->dirty = 0;
+	_STATUS_RECORD_STORE_WRITE_FAILED = 1;
+      }
+      return 0;
+    }
+  }
+
+  record->failed_attempts = 0;
+  record->sequence = page[1];
+  record->slot = slot;
+  return 1;
+}
+
+
+unsigned int RecordStorePageNumber(unsigned int record_id, unsigned int slot) {
+  return (RECORD_STORE_FIRST_PAGE + record_id * RECORD_STORE_SLOTS_PER_RECORD + slot);
+}
+
+
+unsigned int RecordStoreSequenceNewer(unsigned int sequence_1, unsigned int sequence_2) {
+  // Returns 1 if sequence_1 was written after sequence_2, allowing for the sequence number wrapping
+  unsigned int difference;
+  
+  difference = sequence_1 - sequence_2;
+  if ((difference != 0) && (difference < 0x8000)) {
+    return 1;
+  }
+  return 0;
+}
+
+
+unsigned int RecordStoreCRC(unsigned int* page) {
+  /*
+    CRC-16-CCITT of words 0 to 14 of the page, high byte of each word first
+  */
+  unsigned int crc;
+  unsigned int n;
+  unsigned int bit;
+  unsigned char data_byte;
+
+  crc = 0xFFFF;
+  for (n = 0; n < ((RECORD_STORE_PAGE_WORDS - 1) * 2); n++) {
+    if (n & 0x0001) {
+      data_byte = page[n >> 1] & 0xFF;
+    } else {
+      data_byte = page[n >> 1] >> 8;
+    }
+    crc ^= ((unsigned int)data_byte << 8);
+    for (bit = 0; bit < 8; bit++) {
+      if (crc & 0x8000) {
+	crc = (crc << 1) ^ 0x1021;
+      } else {
+	crc <<= 1;
+      }
+    }
+  }
+  return (crc & 0xFFFF);
+}
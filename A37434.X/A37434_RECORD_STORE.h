@@ -0,0 +1,86 @@
+#ifndef __A37434_RECORD_STORE_H
+#define __A37434_RECORD_STORE_H
+
+/*
+  Record store on the external EEPROM
+
+  Each record is one 16 word EEPROM page
+  word 0      - RECORD_STORE_MAGIC in the high byte, record id in the low byte
+  word 1      - sequence number, incremented every time the record is saved
+  word 2-14   - record data (RECORD_STORE_DATA_WORDS)
+  word 15     - CRC16 of words 0-14
+
+  Each record id owns RECORD_STORE_SLOTS_PER_RECORD pages, starting at RECORD_STORE_FIRST_PAGE.
+  A save always goes to the slot after the newest valid copy, so the writes rotate through the slots
+  and the previous copy is not touched until the new one has been read back and checked.
+  If power is lost part way through a write, the CRC of that slot fails and the previous copy is used.
+
+  At boot every slot is read once and the newest valid copy of each record is kept in RAM.
+  After that reads are served from RAM and the EEPROM is only accessed by RecordStoreDoIdle().
+*/
+
+#define RECORD_STORE_MAGIC                0xA5
+#define RECORD_STORE_PAGE_WORDS           16
+#define RECORD_STORE_DATA_WORDS           13
+
+#define RECORD_ID_POWER_CALIBRATION       0
+#define RECORD_STORE_RECORDS              1
+
+
+// Data word locations in the RECORD_ID_POWER_CALIBRATION record
+#define CALIBRATION_REVERSE_SCALE         0
+#define CALIBRATION_REVERSE_OFFSET        1
+#define CALIBRATION_FORWARD_SCALE         2
+#define CALIBRATION_FORWARD_OFFSET        3
+
+
+typedef struct {
+  unsigned int data[RECORD_STORE_DATA_WORDS];
+  unsigned int sequence;
+  unsigned int slot;                             // Slot holding the newest valid copy
+  unsigned int valid;                            // A valid copy was found at boot or has been saved since
+  unsigned int dirty;                            // data has changed and needs to be saved
+  unsigned int failed_attempts;                  // Saves in a row that did not read back correctly
+} TYPE_RECORD;
+
+typedef struct {
+  TYPE_RECORD record[RECORD_STORE_RECORDS];
+  unsigned int eeprom_ok;
+  unsigned int write_count;
+  unsigned int write_failures;
+  unsigned int boot_crc_errors;
+} TYPE_RECORD_STORE;
+
+extern TYPE_RECORD_STORE record_store;
+
+
+void RecordStoreInitialize(unsigned int eeprom_ok);
+/*
+  Reads every slot and loads the newest valid copy of each record into RAM
+  If eeprom_ok is zero the EEPROM is not accessed and all records are left invalid
+*/
+
+unsigned int RecordStoreRead(unsigned int record_id, unsigned int* data);
+/*
+  Copies the RAM copy of the record to data
+  Returns 0 if there is no valid copy of the record, 1 otherwise
+*/
+
+void RecordStoreWrite(unsigned int record_id, unsigned int* data);
+/*
+  Updates the RAM copy of the record and marks it to be saved
+  The EEPROM is not accessed, the record is saved later by RecordStoreDoIdle()
+*/
+
+unsigned int RecordStorePending(void);
+/*
+  Returns 1 if any record is waiting to be saved
+*/
+
+void RecordStoreDoIdle(void);
+/*
+  Saves at most one waiting record
+  Only call this when the EEPROM access time will not interfere with pulsing
+*/
+
+#endif
@@ -11,9 +11,54 @@
 
 
 // Motor Configuration
-#define AFC_MOTOR_MIN_POSITION                 1000
-#define AFC_MOTOR_MAX_POSITION                 34000
-#define MOTOR_SPEED                            200   // Motor Speed in Full Steps per Second
+#define MOTOR_MICROSTEPS_PER_STEP              32    // 32, 64 or 128 - All positions are in units of 1/MOTOR_MICROSTEPS_PER_STEP step
+#define AFC_MOTOR_MIN_POSITION                 POSITION_FROM_32NDS(1000)
+#define AFC_MOTOR_MAX_POSITION                 POSITION_FROM_32NDS(34000)
+#define AFC_MOTOR_END_STOP_POSITION            POSITION_FROM_32NDS(100)   // Position given to the zero end stop by STATE_AUTO_ZERO and the idle re-zero
+#define MOTOR_SPEED                            200   // Starting cruise speed in Full Steps per Second, must be one of DRIVE_SPEED_LEVEL_VALUES
+
+
+// Motor Drive Management Configuration
+// The cruise speed starts at MOTOR_SPEED, moves up a level after DRIVE_PROMOTE_MOVE_TIME of moving without a driver fault (up to DRIVE_MAX_SPEED)
+// A fault drops the speed one level and that level becomes the highest one used until the next power up
+#define DRIVE_SPEED_LEVEL_VALUES               100,150,200,250,300   // Full steps per second
+#define DRIVE_SPEED_LEVELS                     5
+#define DRIVE_START_SPEED                      50     // Full steps per second for the first step after stopping or reversing
+#define DRIVE_ACCEL_STEPS                      POSITION_FROM_32NDS(64)    // The speed ramps from DRIVE_START_SPEED to the cruise speed over 2 steps
+#define DRIVE_RESTART_STOPPED_PERIODS          4      // T1 periods stopped at the target before the next move ramps up from DRIVE_START_SPEED again
+#define DRIVE_PROMOTE_MOVE_TIME                3000   // 30 seconds of moving (10mS units)
+#define DRIVE_MAX_SPEED                        MOTOR_SPEED  // Full steps per second - Only raise this once the faster levels have been validated with the tuner
+#define DRIVE_FAULT_RESET_TIME                 2      // 20mS - nRESET is held low this long to clear a driver fault
+// Current range (ISET) and decay mode for each phase
+#define DRIVE_ISET_ACCEL                       DRIVE_ISET_100_PERCENT
+#define DRIVE_ISET_CRUISE                      DRIVE_ISET_100_PERCENT
+#define DRIVE_ISET_HOLD                        DRIVE_ISET_71_PERCENT
+#define DRIVE_DECAY_ACCEL                      DRIVE_DECAY_MIXED
+#define DRIVE_DECAY_CRUISE                     DRIVE_DECAY_MIXED
+#define DRIVE_DECAY_HOLD                       DRIVE_DECAY_SLOW
+#define DRIVE_FAST_DECAY_SPEED_LEVEL           3      // At this level and above cruising uses fast decay so the current can follow the PWM table
+
+
+// Backlash Configuration
+#define BACKLASH_DEFAULT_STEPS                 0      // Take up steps added on a reversal until an estimate is available
+#define BACKLASH_MAX_STEPS                     POSITION_FROM_32NDS(128)    // 4 steps
+#define BACKLASH_AUTO_ESTIMATE                 1      // Set to 0 to only use the backlash set over CAN
+#define BACKLASH_RESPONSE_REV_PWR_CHANGE       15     // Reverse power change that counts as a response to a move
+#define BACKLASH_MAX_RESPONSE_DISTANCE         POSITION_FROM_32NDS(512)    // If there is no response within this distance the measurement is discarded
+
+
+// Pulse Synchronous Motion Configuration
+#define PULSE_SYNC_INTERVAL_HISTORY            4      // Must be a power of 2
+#define PULSE_SYNC_MIN_VALID_INTERVALS         4      // Consecutive consistent intervals before the guard window is used
+#define PULSE_SYNC_GUARD_BEFORE_US             400    // The motor will not step this long before a predicted pulse
+#define PULSE_SYNC_GUARD_LATE_US               1000   // If the pulse is this late, the motor is released until the next pulse
+#define PULSE_SYNC_SAMPLE_TIMEOUT_US           500    // Maximum time the motor is held waiting for INT1 to read back the sample
+#define PULSE_SYNC_MAX_INTERVAL                40     // 400mS - With a longer gap between pulses the prediction is discarded (TMR2 rollover is 419mS)
+
+
+// Startup Configuration
+// The motor is homed while the rest of the board starts up, STATE_RUN_AFC is entered once it is home and the ECB has configured the board
+#define STARTUP_CONFIGURATION_TIMEOUT          1000   // 10 seconds from power up - Without a configuration the default home position is used
 
 
 // Cooldown Configuration
@@ -21,23 +66,66 @@
 #define LIMIT_RECORDED_OFF_TIME                120000 // 1200 seconds, 20 minutes // 240 elements
 
 
+// Run Notice Configuration
+// The ECB can announce the PRF, energy mode and start time of the next run so the tuner is in place before the first pulse
+#define RUN_NOTICE_LATE_LIMIT                  1000   // 10 seconds - If the run has not started this long after the announced time the notice is dropped
+#define RUN_NOTICE_MIN_PRF                     3      // Hz - A slower PRF does not fit in TMR2 (PULSE_SYNC_MAX_INTERVAL) and is not preloaded
+#define RUN_NOTICE_REZERO_TIME                 1500   // 15 seconds - An idle re-zero is not started when the run is announced to start sooner than this
+
+
 // Fast Mode Movement Configuration
-#define AFC_CONTROL_WINDOW_RANGE               4000  // IF the Motor is more than this far away from the home position, it will just move to home position instead
-#define FAST_MOVE_TARGET_DELTA                 64    // 2 steps
+#define AFC_CONTROL_WINDOW_RANGE               POSITION_FROM_32NDS(4000)  // IF the Motor is more than this far away from the home position, it will just move to home position instead
+#define FAST_MOVE_TARGET_DELTA                 (MOTOR_MICROSTEPS_PER_STEP * 2)  // 2 steps at every resolution, fast mode keeps the motor moving at cruise speed between pulses
 #define MAX_NO_DECISION_COUNTER                4
-#define MINIMUM_POSITION_CHANGE                16
+#define MINIMUM_POSITION_CHANGE                POSITION_FROM_32NDS(16)
 
 #define MINIMUM_REV_PWR_CHANGE_16K_PLUS         7    
 #define MINIMUM_REV_PWR_CHANGE_11K_16K          5    
 #define MINIMUM_REV_PWR_CHANGE_11K_MINUS        3
+// The fixed values above are only used until the noise floor estimate is ready
+
+// Noise Floor Estimate Configuration
+// The minimum reverse power change is NOISE_FLOOR_THRESHOLD_MULTIPLE times the mean pulse to pulse change at an unchanged position
+#define NOISE_FLOOR_THRESHOLD_MULTIPLE          32    // 1/16 units, 32 = 2x the mean change
+#define NOISE_FLOOR_MIN_SAMPLES                 32    // Samples needed before the estimate is used
+#define NOISE_FLOOR_FILTER_SHIFT                6     // Estimate time constant is 2^NOISE_FLOOR_FILTER_SHIFT samples
+#define NOISE_FLOOR_MIN_THRESHOLD               2
+
+
+// AFC Strategy Selection - Can be changed over CAN with ETM_CAN_REGISTER_AFC_CMD_SELECT_STRATEGY
+#define AFC_STRATEGY_DEFAULT_FAST               AFC_STRATEGY_FAST_VOTE
+#define AFC_STRATEGY_DEFAULT_SLOW               AFC_STRATEGY_SLOW_DWELL
+
+
+// Dual Energy Configuration
+#define AFC_ENERGY_BANKS                        2
+#define ENERGY_BANK_WEIGHT_TOTAL                256
+#define ENERGY_BANK_1_DEFAULT_WEIGHT            128   // Equal weight for both energies
+#define ENERGY_BANK_TIMEOUT_PULSES              8     // A bank that has not had a pulse in this many pulses does not move the motor
 
 
 // Slow Mode Movement Configuaration
 
+/*
+  Move sizes are in positions (1/MOTOR_MICROSTEPS_PER_STEP step) and are set for each resolution
+  Slow mode dithers around the optimum by MOVE_SIZE_SMALL, finer microstepping is used to make that dither smaller.
+  The move still has to change the reverse power by more than the noise, so 4x the resolution only halves the standard moves:
+    Standard magnetron  32 - 64/32 (2 and 1 step), 64 - 96/48, 128 - 128/64 (1 and 1/2 step)
+    NJRC (high Q)       16/8 positions at every resolution (1/4 step at 32, 1/16 step at 128)
+*/
+
 #ifndef __NJRC_MAGNETRON
 
+#if MOTOR_MICROSTEPS_PER_STEP == 32
 #define MOVE_SIZE_BIG          64
 #define MOVE_SIZE_SMALL        32
+#elif MOTOR_MICROSTEPS_PER_STEP == 64
+#define MOVE_SIZE_BIG          96
+#define MOVE_SIZE_SMALL        48
+#else
+#define MOVE_SIZE_BIG          128
+#define MOVE_SIZE_SMALL        64
+#endif
 #define SAMPLES_AT_EACH_POINT  32
 
 #else
@@ -48,11 +136,77 @@
 
 #endif
 
+/*
+  Slow mode dwell sequential test
+  After SLOW_DWELL_MIN_SAMPLES each pulse checks whether this dwell is already clearly better or worse than the previous one.
+  SAMPLES_AT_EACH_POINT is the maximum dwell, if there is no decision by then the averages are compared as before.
+  The test is an SPRT for a shift of +/- 1 sigma in the mean reverse power with 1% error rates (ln(99) = 4.6).
+  For Gaussian noise the boundary on the sum of (reading - previous mean) is 4.6 / 2 sigma, widened for the uncertainty of the previous mean.
+  sigma is 0.886 * the noise floor estimate, so SLOW_DWELL_SPRT_BOUNDARY = 16 * 2.3 * 0.886 = 33 (1/16 units).
+  Larger values make fewer early decisions and fewer wrong ones.
+*/
+#define SLOW_DWELL_MIN_SAMPLES                  8
+#define SLOW_DWELL_SPRT_BOUNDARY                33
+
+
+
+// Reverse Power Outlier Filter Configuration
+// A reading further than OUTLIER_MAD_MULTIPLE * MAD from the median of the last OUTLIER_WINDOW readings is not used by the AFC
+#define OUTLIER_WINDOW                         9      // Must be odd
+#define OUTLIER_MAD_MULTIPLE                   6
+#define OUTLIER_MIN_DEVIATION                  100    // Readings closer than this to the median are always used
+
+
+// Reverse Power Map Configuration
+// Every pulse is added to a map of reverse power against position, relative to the home position
+// The map moves the fast mode start to the best known position near the cooldown position and breaks tied fast mode votes
+#define POWER_MAP_BINS                         64     // Must be a power of 2, the map is centered on the home position
+#define POWER_MAP_BIN_SHIFT                    7      // Bins are 2^POWER_MAP_BIN_SHIFT 1/32 steps wide (4 steps), 64 bins cover AFC_CONTROL_WINDOW_RANGE
+#define POWER_MAP_FILTER_WEIGHT                15     // Each bin is the average of about this many pulses
+#define POWER_MAP_MAX_WEIGHT                   64
+#define POWER_MAP_MIN_WEIGHT                   4      // Bins with less weight are not used
+#define POWER_MAP_DECAY_TIME                   6000   // 60 seconds - Every bin loses 1/8 of its weight (+1) this often, an unused bin is forgotten in about 17 minutes
+#define POWER_MAP_SEED_BINS                    2      // The fast mode start is moved at most this many bins from the cooldown position
+#define POWER_MAP_MIN_DIFFERENCE               20     // Reverse power difference between bins that the map acts on
+
+
+// Home Position Scan Configuration
+#define SCAN_BINS                              32     // The scan range is divided into this many bins
+#define SCAN_DEFAULT_SPEED                     4      // 1/32 steps per 10mS (12.5 Steps per second) if the command does not give one
+
+
+// Idle Re-zero Configuration
+// After REZERO_IDLE_TIME in AFC mode without a pulse the cooldown is finished and the motor is re-referenced against the zero end stop
+#define REZERO_ENABLE                          1
+#define REZERO_IDLE_TIME                       LIMIT_RECORDED_OFF_TIME    // 20 minutes, time in manual mode does not count
+#define REZERO_OVERTRAVEL                      POSITION_FROM_32NDS(256)   // 8 steps past where the end stop should be
+
+
+// Telemetry Configuration
+#define HISTOGRAM_POWER_SHIFT                  12     // Power histogram bin = reading >> HISTOGRAM_POWER_SHIFT
+#define HISTOGRAM_POSITION_SHIFT               5      // Position error histogram bins are 2^HISTOGRAM_POSITION_SHIFT 1/32 steps wide (1 step)
+#define TELEMETRY_STREAM_PERIOD                100    // 1 second between telemetry messages when streaming
+
+
+// EEPROM Record Store Configuration
+#define RECORD_STORE_FIRST_PAGE                0xC0   // Pages below this are left for the ETM libraries
+#define RECORD_STORE_SLOTS_PER_RECORD          8      // Number of pages each record rotates through
+#define RECORD_STORE_IDLE_TIME                 50     // 500mS without a pulse before the EEPROM is written
 
 
 // Fast to Slow mode switch configuration
-#define MAXIMUM_FAST_MODE_PULSES               400
-#define MAXIMUM_FAST_MODE_TIME                 80     // 800 milliseconds
+// Fast mode ends when it has converged, these limits are a backstop in case convergence is never detected
+#define MAXIMUM_FAST_MODE_PULSES               2000
+#define MAXIMUM_FAST_MODE_TIME                 400    // 4 seconds
+
+#define CONVERGED_MIN_PULSES                   32
+#define CONVERGED_POSITION_SPAN                POSITION_FROM_32NDS(256)    // 8 steps
+#define CONVERGED_VOTE_HISTORY                 8      // Number of recent fast mode votes checked for alternation
+#define CONVERGED_MIN_ALTERNATIONS             3
+#define CONVERGED_REV_PWR_MARGIN               15     // Average of the last 4 reverse power readings must be within this of the minimum
+
+#define DISTURBANCE_REV_PWR_STEP               60     // Reverse power this far above the reference is a step disturbance
+#define DISTURBANCE_PULSES                     8      // Consecutive pulses needed to declare a step disturbance
 
 
 #endif
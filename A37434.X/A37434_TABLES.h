@@ -0,0 +1,33 @@
+// Generated by tools/generate_tables.py - DO NOT EDIT, change the parameters in the generator and run "make tables"
+#ifndef __A37434_TABLES_H
+#define __A37434_TABLES_H
+
+/*
+  PWM quarter tables, PTPER = 500
+  value = 5% + peak * sin(pi * index / (MOTOR_PWM_TABLE_SIZE/2)) of 2*PTPER
+  FULL_POWER peak = 53%, LOW_POWER peak = 30%
+*/
+#define FULL_POWER_QUARTER_TABLE_VALUES_32 50,253,425,540,580
+
+#define FULL_POWER_QUARTER_TABLE_VALUES_64 50,63,76,89,102,115,128,141,153,166,179,191,204,216,229,241,253,265,277,288,300,311,322,334,344,355,366,376,386,396,406,415,425,434,443,451,460,468,476,483,491,498,505,511,517,523,529,535,540,544,549,553,557,561,564,567,570,572,574,576,577,579,579,580,580
+
+#define FULL_POWER_QUARTER_TABLE_VALUES_128 50,57,63,70,76,82,89,95,102,108,115,121,128,134,141,147,153,160,166,172,179,185,191,198,204,210,216,222,229,235,241,247,253,259,265,271,277,282,288,294,300,306,311,317,322,328,334,339,344,350,355,360,366,371,376,381,386,391,396,401,406,411,415,420,425,429,434,438,443,447,451,456,460,464,468,472,476,480,483,487,491,494,498,501,505,508,511,514,517,520,523,526,529,532,535,537,540,542,544,547,549,551,553,555,557,559,561,562,564,566,567,569,570,571,572,573,574,575,576,577,577,578,579,579,579,580,580,580,580
+
+#define LOW_POWER_QUARTER_TABLE_VALUES_32 50,165,262,327,350
+
+#define LOW_POWER_QUARTER_TABLE_VALUES_64 50,57,65,72,79,87,94,101,109,116,123,130,137,144,151,158,165,172,178,185,191,198,204,210,217,223,229,235,240,246,251,257,262,267,272,277,282,287,291,295,299,303,307,311,315,318,321,324,327,330,332,335,337,339,341,343,344,346,347,348,349,349,350,350,350
+
+#define LOW_POWER_QUARTER_TABLE_VALUES_128 50,54,57,61,65,68,72,76,79,83,87,90,94,98,101,105,109,112,116,119,123,126,130,134,137,141,144,148,151,155,158,161,165,168,172,175,178,182,185,188,191,195,198,201,204,207,210,214,217,220,223,226,229,232,235,237,240,243,246,249,251,254,257,260,262,265,267,270,272,275,277,280,282,284,287,289,291,293,295,297,299,301,303,305,307,309,311,313,315,316,318,320,321,323,324,326,327,329,330,331,332,334,335,336,337,338,339,340,341,342,343,343,344,345,346,346,347,347,348,348,349,349,349,349,350,350,350,350,350
+
+/*
+  Cooldown knots, 5.12 second slots, ends after 1167 seconds
+  0.20 * exp(-t / 12s)
+  0.40 * exp(-t / 90s)
+  0.45 * exp(-t / 600s)
+  Limited to 0.95, interpolation error 51/32768
+*/
+#define COOL_DOWN_KNOT_VALUES 31130,31130,28985,27246,25880,24768,23833,23023,22303,21052,19972,19012,18146,16635,15361,14277,13345,11828,10644,9686,8884,7589,6555,5693,4956,3766,2865,2180,1593
+#define COOL_DOWN_KNOTS                   29
+#define COOL_DOWN_END_INDEX               228
+
+#endif
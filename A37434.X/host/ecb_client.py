@@ -0,0 +1,262 @@
+#!/usr/bin/env python3
+"""
+Scripted ECB for the A37434 host build (see etm_can_loopback.h).
+
+Sends the sync message, board commands and the simulated linac settings to
+a37434_host and records what the board sends back.  The register numbers are
+read from the firmware headers so this follows the firmware.
+
+  python3 ecb_client.py --demo              home, run AFC against the simulated linac, print the results
+  python3 ecb_client.py --demo --seconds 60
+
+As a library:
+
+  with EcbClient() as ecb:
+      ecb.set_home(30000)
+      ecb.sim_linac(prf=400, resonance=28000)
+      ecb.afc_mode()
+      ecb.wait(10)
+      print(ecb.log_data[2])
+
+Only the standard library is used.
+"""
+
+import argparse
+import os
+import re
+import socket
+import struct
+import threading
+import time
+
+
+HOST_DIR = os.path.dirname(os.path.abspath(__file__))
+HEADERS = (
+    os.path.join(HOST_DIR, "..", "A37434.h"),
+    os.path.join(HOST_DIR, "include", "P1395_CAN_SLAVE.h"),
+    os.path.join(HOST_DIR, "etm_can_loopback.h"),
+)
+
+
+def read_defines(paths=HEADERS):
+    defines = {}
+    pattern = re.compile(r"^#define\s+(\w+)\s+(0x[0-9A-Fa-f]+|\d+)\b", re.MULTILINE)
+    for path in paths:
+        with open(path) as header:
+            for name, value in pattern.findall(header.read()):
+                defines.setdefault(name, int(value, 0))
+    return defines
+
+
+D = read_defines()
+FRAME = struct.Struct("<5H")
+
+
+class EcbClient(object):
+
+    def __init__(self, board_port=None, ecb_port=None, sync_rate=20.0, address=None):
+        self.board = ("127.0.0.1", board_port or int(os.environ.get("A37434_BOARD_PORT", D["LOOPBACK_BOARD_PORT"])))
+        self.address = D["ETM_CAN_ADDR_AFC_CONTROL_BOARD"] if address is None else address
+        self.sync_period = 1.0 / sync_rate
+        self.sync_control = D["LOOPBACK_SYNC_RESET_ENABLE"]
+
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(("127.0.0.1", ecb_port or int(os.environ.get("A37434_ECB_PORT", D["LOOPBACK_ECB_PORT"]))))
+        self.sock.settimeout(0.1)
+
+        self.lock = threading.Lock()
+        self.status = None
+        self.log_data = [0] * 24
+        self.debug_data = [0] * 16
+        self.pulse_log = {}                 # log register -> list of (time, words)
+        self.board_stats = []               # (time, tx frames/s, rx frames/s, dropped total, bus load permille)
+        self.frame_counts = {}
+        self.frames_sent = 0
+        self.latencies = []
+        self._pending = {}                  # register -> list of send times waiting for an ack
+        self._acked = threading.Condition(self.lock)
+
+        self.running = True
+        self.start_time = time.time()
+        self._threads = [threading.Thread(target=self._receive_loop), threading.Thread(target=self._sync_loop)]
+        for thread in self._threads:
+            thread.daemon = True
+            thread.start()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def close(self):
+        self.running = False
+        for thread in self._threads:
+            thread.join()
+        self.sock.close()
+
+    # ---------------- Sending ----------------
+
+    def send(self, identifier, word0=0, word1=0, word2=0, word3=0):
+        self.sock.sendto(FRAME.pack(identifier & 0xFFFF, word0 & 0xFFFF, word1 & 0xFFFF, word2 & 0xFFFF, word3 & 0xFFFF), self.board)
+        with self.lock:
+            self.frames_sent += 1
+
+    def command(self, register, word0=0, word1=0, word2=0, wait=True, timeout=1.0):
+        """Send a board command, return the time to the acknowledge in seconds (None if there was none)"""
+        sent = time.time()
+        with self.lock:
+            self._pending.setdefault(register, []).append(sent)
+        self.send(D["LOOPBACK_ID_CMD"] + self.address, word0, word1, word2, register)
+        if not wait:
+            return None
+        deadline = sent + timeout
+        with self.lock:
+            while sent in self._pending.get(register, []):
+                remaining = deadline - time.time()
+                if remaining <= 0:
+                    self._pending[register].remove(sent)
+                    return None
+                self._acked.wait(remaining)
+            return self.latencies[-1]
+
+    def set_home(self, position_32nds):
+        return self.command(D["ETM_CAN_REGISTER_AFC_SET_1_HOME_POSITION_AND_OFFSET"], position_32nds)
+
+    def afc_mode(self):
+        return self.command(D["ETM_CAN_REGISTER_AFC_CMD_SELECT_AFC_MODE"])
+
+    def manual_mode(self):
+        return self.command(D["ETM_CAN_REGISTER_AFC_CMD_SELECT_MANUAL_MODE"])
+
+    def manual_target(self, position_32nds):
+        return self.command(D["ETM_CAN_REGISTER_AFC_CMD_SET_MANUAL_TARGET_POSITION"], position_32nds)
+
+    def run_notice(self, prf, time_to_start, energy_mode=None):
+        """Announce the next run, time_to_start in seconds"""
+        if energy_mode is None:
+            energy_mode = D["RUN_NOTICE_ENERGY_MODE_UNCHANGED"]
+        return self.command(D["ETM_CAN_REGISTER_AFC_CMD_RUN_NOTICE"], prf, energy_mode, int(time_to_start * 100))
+
+    def sim_linac(self, prf=0, resonance=28000, hot_shift=-600, noise=20):
+        """prf in Hz (0 stops the pulses), resonance and hot_shift in 1/32 steps, noise in external ADC counts"""
+        self.send(D["LOOPBACK_ID_SIM"], prf, resonance, hot_shift, noise)
+
+    def set_high_speed_logging(self, enable):
+        if enable:
+            self.sync_control |= D["LOOPBACK_SYNC_HIGH_SPEED_LOGGING"]
+        else:
+            self.sync_control &= ~D["LOOPBACK_SYNC_HIGH_SPEED_LOGGING"]
+
+    def wait(self, seconds):
+        time.sleep(seconds)
+
+    # ---------------- Receiving ----------------
+
+    def _sync_loop(self):
+        next_sync = time.time()
+        while self.running:
+            self.send(D["LOOPBACK_ID_SYNC"], self.sync_control)
+            next_sync += self.sync_period
+            time.sleep(max(0.0, next_sync - time.time()))
+
+    def _receive_loop(self):
+        while self.running:
+            try:
+                data = self.sock.recv(64)
+            except socket.timeout:
+                continue
+            except OSError:
+                return
+            if len(data) != FRAME.size:
+                continue
+            self._handle(time.time(), FRAME.unpack(data))
+
+    def _handle(self, now, frame):
+        identifier, words = frame[0], list(frame[1:])
+        with self.lock:
+            self.frame_counts[identifier] = self.frame_counts.get(identifier, 0) + 1
+            if identifier == D["LOOPBACK_ID_CMD_ACK"] + self.address:
+                sent_times = self._pending.get(words[3])
+                if sent_times:
+                    self.latencies.append(now - sent_times.pop(0))
+                    self._acked.notify_all()
+            elif identifier == D["LOOPBACK_ID_STATUS"] + self.address:
+                self.status = words
+            elif D["LOOPBACK_ID_LOG_DATA"] <= identifier < D["LOOPBACK_ID_LOG_DATA"] + 6:
+                n = identifier - D["LOOPBACK_ID_LOG_DATA"]
+                self.log_data[4 * n:4 * n + 4] = words
+            elif D["LOOPBACK_ID_DEBUG"] <= identifier < D["LOOPBACK_ID_DEBUG"] + 4:
+                n = identifier - D["LOOPBACK_ID_DEBUG"]
+                self.debug_data[4 * n:4 * n + 4] = words
+            elif identifier == D["LOOPBACK_ID_STATS"]:
+                self.board_stats.append([now] + words)
+            elif D["LOOPBACK_ID_PULSE_LOG"] <= identifier < D["LOOPBACK_ID_PULSE_LOG"] + 0x100:
+                self.pulse_log.setdefault(identifier - D["LOOPBACK_ID_PULSE_LOG"], []).append((now, words))
+
+    # ---------------- Reports ----------------
+
+    def frame_rates(self):
+        """Frames per second received from the board by CAN identifier"""
+        elapsed = max(time.time() - self.start_time, 1e-6)
+        with self.lock:
+            return dict((identifier, count / elapsed) for identifier, count in sorted(self.frame_counts.items()))
+
+    def latency_summary(self):
+        with self.lock:
+            if not self.latencies:
+                return None
+            values = list(self.latencies)
+        return (min(values), sum(values) / len(values), max(values), len(values))
+
+
+def demo(seconds):
+    with EcbClient() as ecb:
+        print("Waiting for the board on udp port %d" % ecb.board[1])
+        deadline = time.time() + 5
+        while ecb.status is None and time.time() < deadline:
+            time.sleep(0.05)
+        if ecb.status is None:
+            raise SystemExit("No status from the board, is a37434_host running?")
+
+        ecb.sim_linac(prf=0)
+        print("set home 30000      ack %.2fmS" % (1000 * (ecb.set_home(30000) or 0)))
+        print("AFC mode            ack %.2fmS" % (1000 * (ecb.afc_mode() or 0)))
+        ecb.wait(2)
+        ecb.sim_linac(prf=400, resonance=28000, hot_shift=-600, noise=20)
+
+        start = time.time()
+        while time.time() - start < seconds:
+            ecb.wait(1)
+            log = ecb.log_data
+            print("t=%5.1fs  target %5d  position %5d  reverse %5d  forward %5d  control 0x%04X" %
+                  (time.time() - start, log[1], log[2], log[5], log[6], ecb.status[0]))
+            ecb.manual_target(log[2])   # Keeps a steady stream of commands for the latency figures
+
+        print("")
+        print("Frames received per second")
+        for identifier, rate in ecb.frame_rates().items():
+            print("  0x%03X  %7.1f" % (identifier, rate))
+        if ecb.board_stats:
+            last = ecb.board_stats[-1]
+            print("Board: %d frames/s sent, %d frames/s received, %d dropped, bus load %.1f%%" %
+                  (last[1], last[2], last[3], last[4] / 10.0))
+        summary = ecb.latency_summary()
+        if summary:
+            print("Command latency: min %.2fmS  mean %.2fmS  max %.2fmS  (%d commands)" %
+                  (1000 * summary[0], 1000 * summary[1], 1000 * summary[2], summary[3]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Scripted ECB for the A37434 host build")
+    parser.add_argument("--demo", action="store_true", help="home, run AFC against the simulated linac and report")
+    parser.add_argument("--seconds", type=float, default=20, help="length of the demo AFC run")
+    args = parser.parse_args()
+    if args.demo:
+        demo(args.seconds)
+    else:
+        parser.print_help()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,290 @@
+/*
+  Host implementation of the ETM CAN slave API over UDP (see etm_can_loopback.h)
+
+  The bus is modelled at LOOPBACK_CAN_BIT_RATE.  Frames from the board wait in a queue until the bus is free,
+  so a burst of pulse logs is spread out the way it would be on the real bus and drops once the queue is full.
+  Received frames are counted in the bus load but are never delayed.
+
+  The firmware calls ETMCanSlaveDoCan() on every pass of the main loop, so that is also where the simulated
+  timers and the simulated linac are serviced (HostSimulationService()).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "P1395_CAN_SLAVE.h"
+#include "etm_can_loopback.h"
+
+ETMCanBoardData slave_board_data;
+ETMCanStatusRegister etm_can_control_register;
+ETMCanStatusRegister etm_can_fault_register;
+unsigned int etm_can_warning_register;
+unsigned int etm_can_not_logged_register;
+
+typedef struct {
+  int socket_fd;
+  struct sockaddr_in ecb_address;
+  unsigned int address;
+
+  ETMCanMessage tx_queue[LOOPBACK_TX_QUEUE_SIZE];
+  unsigned int tx_head;
+  unsigned int tx_count;
+  unsigned long bus_free_time;                   // Time the frame on the bus finishes
+
+  unsigned int sync_control;
+  unsigned long last_sync_time;
+  unsigned int com_fault;
+
+  unsigned long next_status_time;
+  unsigned int slow_frame_index;
+
+  unsigned long next_stats_time;
+  unsigned long bus_bits;                        // Bits on the bus since the last stats message
+  unsigned int tx_frames;
+  unsigned int rx_frames;
+  unsigned int tx_dropped;
+} TYPE_LOOPBACK;
+
+static TYPE_LOOPBACK loopback;
+
+static void LoopbackQueueFrame(unsigned int identifier, unsigned int word0, unsigned int word1, unsigned int word2, unsigned int word3);
+static void LoopbackSendQueued(unsigned long now);
+static void LoopbackReceive(void);
+static void LoopbackSendSlowFrames(void);
+
+
+static unsigned int PortFromEnvironment(const char* name, unsigned int default_port) {
+  const char* value;
+
+  value = getenv(name);
+  if (value && atoi(value)) {
+    return atoi(value);
+  }
+  return default_port;
+}
+
+
+void ETMCanSlaveInitialize(unsigned int requested_can_port, unsigned long fcy, unsigned int address, unsigned long can_operation_led, unsigned int can_interrupt_priority, unsigned long flash_led, unsigned long not_ready_led) {
+  struct sockaddr_in board_address;
+
+  memset(&loopback, 0, sizeof(loopback));
+  loopback.address = address;
+
+  loopback.socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (loopback.socket_fd < 0) {
+    perror("loopback socket");
+    exit(1);
+  }
+
+  memset(&board_address, 0, sizeof(board_address));
+  board_address.sin_family = AF_INET;
+  board_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  board_address.sin_port = htons(PortFromEnvironment("A37434_BOARD_PORT", LOOPBACK_BOARD_PORT));
+  if (bind(loopback.socket_fd, (struct sockaddr*)&board_address, sizeof(board_address)) < 0) {
+    perror("loopback bind");
+    exit(1);
+  }
+
+  memset(&loopback.ecb_address, 0, sizeof(loopback.ecb_address));
+  loopback.ecb_address.sin_family = AF_INET;
+  loopback.ecb_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  loopback.ecb_address.sin_port = htons(PortFromEnvironment("A37434_ECB_PORT", LOOPBACK_ECB_PORT));
+
+  // No sync message has been received yet
+  loopback.com_fault = 1;
+  loopback.next_status_time = HostTimeMicroseconds();
+  loopback.next_stats_time = loopback.next_status_time + LOOPBACK_STATS_PERIOD_US;
+
+  printf("A37434 host build: board on udp port %u, ECB on udp port %u\n",
+	 ntohs(board_address.sin_port), ntohs(loopback.ecb_address.sin_port));
+  fflush(stdout);
+}
+
+
+void ETMCanSlaveLoadConfiguration(unsigned long agile_id, unsigned int agile_dash, unsigned int firmware_agile_rev, unsigned int firmware_branch, unsigned int firmware_branch_rev) {
+  printf("A37434 host build: agile %lu-%03u firmware %u.%u.%u\n", agile_id, agile_dash, firmware_agile_rev, firmware_branch, firmware_branch_rev);
+  fflush(stdout);
+}
+
+
+void ETMCanSlaveDoCan(void) {
+  unsigned long now;
+  unsigned int bus_load;
+
+  HostSimulationService();
+  LoopbackReceive();
+
+  now = HostTimeMicroseconds();
+  if ((now - loopback.last_sync_time) > LOOPBACK_SYNC_TIMEOUT_US) {
+    loopback.com_fault = 1;
+  }
+
+  if (now >= loopback.next_status_time) {
+    loopback.next_status_time += LOOPBACK_STATUS_PERIOD_US;
+    LoopbackQueueFrame(LOOPBACK_ID_STATUS + loopback.address,
+		       _CONTROL_REGISTER, _FAULT_REGISTER, _WARNING_REGISTER, _NOT_LOGGED_REGISTER);
+    LoopbackSendSlowFrames();
+    LoopbackSendSlowFrames();
+  }
+
+  if (now >= loopback.next_stats_time) {
+    loopback.next_stats_time += LOOPBACK_STATS_PERIOD_US;
+    bus_load = (unsigned int)((loopback.bus_bits * 1000) / LOOPBACK_CAN_BIT_RATE);
+    LoopbackQueueFrame(LOOPBACK_ID_STATS, loopback.tx_frames, loopback.rx_frames, loopback.tx_dropped, bus_load);
+    loopback.tx_frames = 0;
+    loopback.rx_frames = 0;
+    loopback.bus_bits = 0;
+  }
+
+  LoopbackSendQueued(now);
+}
+
+
+void ETMCanSlaveLogPulseData(unsigned int packet_id, unsigned int word3, unsigned int word2, unsigned int word1, unsigned int word0) {
+  LoopbackQueueFrame(LOOPBACK_ID_PULSE_LOG + (packet_id & 0x00FF), word0, word1, word2, word3);
+  LoopbackSendQueued(HostTimeMicroseconds());
+}
+
+
+void ETMCanSlaveSetDebugRegister(unsigned int debug_register, unsigned int debug_value) {
+  slave_board_data.debug_data[debug_register & 0x000F] = debug_value;
+}
+
+
+unsigned int ETMCanSlaveGetComFaultStatus(void) {
+  return loopback.com_fault;
+}
+
+
+unsigned int ETMCanSlaveGetSyncMsgResetEnable(void) {
+  return ((loopback.sync_control & LOOPBACK_SYNC_RESET_ENABLE) != 0);
+}
+
+
+unsigned int ETMCanSlaveGetSyncMsgHighSpeedLogging(void) {
+  return ((loopback.sync_control & LOOPBACK_SYNC_HIGH_SPEED_LOGGING) != 0);
+}
+
+
+unsigned int ETMCanSlaveGetPulseCount(void) {
+  return HostPulseCount();
+}
+
+
+static void LoopbackSendSlowFrames(void) {
+  // The 6 log data frames and the 4 debug frames are sent in turn
+  unsigned int n;
+
+  n = loopback.slow_frame_index;
+  if (n < 6) {
+    LoopbackQueueFrame(LOOPBACK_ID_LOG_DATA + n,
+		       slave_board_data.log_data[4*n], slave_board_data.log_data[4*n + 1],
+		       slave_board_data.log_data[4*n + 2], slave_board_data.log_data[4*n + 3]);
+  } else {
+    n -= 6;
+    LoopbackQueueFrame(LOOPBACK_ID_DEBUG + n,
+		       slave_board_data.debug_data[4*n], slave_board_data.debug_data[4*n + 1],
+		       slave_board_data.debug_data[4*n + 2], slave_board_data.debug_data[4*n + 3]);
+  }
+  loopback.slow_frame_index++;
+  if (loopback.slow_frame_index >= 10) {
+    loopback.slow_frame_index = 0;
+  }
+}
+
+
+static void LoopbackQueueFrame(unsigned int identifier, unsigned int word0, unsigned int word1, unsigned int word2, unsigned int word3) {
+  ETMCanMessage* frame;
+
+  if (loopback.tx_count >= LOOPBACK_TX_QUEUE_SIZE) {
+    loopback.tx_dropped++;
+    return;
+  }
+  frame = &loopback.tx_queue[(loopback.tx_head + loopback.tx_count) % LOOPBACK_TX_QUEUE_SIZE];
+  frame->identifier = identifier;
+  frame->word0 = word0;
+  frame->word1 = word1;
+  frame->word2 = word2;
+  frame->word3 = word3;
+  loopback.tx_count++;
+}
+
+
+static void LoopbackSendQueued(unsigned long now) {
+  ETMCanMessage* frame;
+  unsigned char data[10];
+
+  while (loopback.tx_count && (loopback.bus_free_time <= now)) {
+    frame = &loopback.tx_queue[loopback.tx_head];
+    data[0] = frame->identifier;
+    data[1] = frame->identifier >> 8;
+    data[2] = frame->word0;
+    data[3] = frame->word0 >> 8;
+    data[4] = frame->word1;
+    data[5] = frame->word1 >> 8;
+    data[6] = frame->word2;
+    data[7] = frame->word2 >> 8;
+    data[8] = frame->word3;
+    data[9] = frame->word3 >> 8;
+    sendto(loopback.socket_fd, data, sizeof(data), 0, (struct sockaddr*)&loopback.ecb_address, sizeof(loopback.ecb_address));
+
+    if (loopback.bus_free_time < now) {
+      loopback.bus_free_time = now;
+    }
+    loopback.bus_free_time += (LOOPBACK_CAN_FRAME_BITS * 1000000UL) / LOOPBACK_CAN_BIT_RATE;
+    loopback.bus_bits += LOOPBACK_CAN_FRAME_BITS;
+    loopback.tx_frames++;
+    loopback.tx_head = (loopback.tx_head + 1) % LOOPBACK_TX_QUEUE_SIZE;
+    loopback.tx_count--;
+  }
+}
+
+
+static void LoopbackReceive(void) {
+  unsigned char data[16];
+  ETMCanMessage message;
+  fd_set read_set;
+  struct timeval timeout;
+  ssize_t length;
+
+  while (1) {
+    // A short wait here keeps the host from spinning at 100% while still servicing T1 on time
+    FD_ZERO(&read_set);
+    FD_SET(loopback.socket_fd, &read_set);
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 20;
+    if (select(loopback.socket_fd + 1, &read_set, 0, 0, &timeout) <= 0) {
+      return;
+    }
+    length = recv(loopback.socket_fd, data, sizeof(data), 0);
+    if (length != 10) {
+      continue;
+    }
+    message.identifier = data[0] | (data[1] << 8);
+    message.word0 = data[2] | (data[3] << 8);
+    message.word1 = data[4] | (data[5] << 8);
+    message.word2 = data[6] | (data[7] << 8);
+    message.word3 = data[8] | (data[9] << 8);
+
+    if (message.identifier != LOOPBACK_ID_SIM) {
+      loopback.rx_frames++;
+      loopback.bus_bits += LOOPBACK_CAN_FRAME_BITS;
+    }
+
+    if (message.identifier == LOOPBACK_ID_SYNC) {
+      loopback.sync_control = message.word0;
+      loopback.last_sync_time = HostTimeMicroseconds();
+      loopback.com_fault = 0;
+    } else if (message.identifier == (LOOPBACK_ID_CMD + loopback.address)) {
+      ETMCanSlaveExecuteCMDBoardSpecific(&message);
+      LoopbackQueueFrame(LOOPBACK_ID_CMD_ACK + loopback.address, message.word0, message.word1, message.word2, message.word3);
+    } else if (message.identifier == LOOPBACK_ID_SIM) {
+      HostSimulationControl(message.word0, message.word1, message.word2, message.word3);
+    }
+  }
+}
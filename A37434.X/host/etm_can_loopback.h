@@ -0,0 +1,44 @@
+/*
+  Loopback CAN transport shared by etm_can_loopback.c, host_hal.c and ecb_client.py
+
+  Each CAN frame is one UDP datagram of 5 little endian 16 bit words: identifier, word0, word1, word2, word3
+  The board listens on LOOPBACK_BOARD_PORT and sends to LOOPBACK_ECB_PORT on 127.0.0.1
+  (A37434_BOARD_PORT and A37434_ECB_PORT in the environment override the ports)
+*/
+#ifndef __ETM_CAN_LOOPBACK_H
+#define __ETM_CAN_LOOPBACK_H
+
+#define LOOPBACK_BOARD_PORT              5434
+#define LOOPBACK_ECB_PORT                5435
+
+// ECB to board
+#define LOOPBACK_ID_SYNC                 0x001    // word0 is the sync control bits
+#define LOOPBACK_ID_CMD                  0x100    // + board address, word3 is the register, word0-2 are the data
+#define LOOPBACK_ID_SIM                  0x7F0    // Simulated linac, word0 PRF (Hz, 0 is off), word1 cold resonance (1/32 steps), word2 hot shift (signed 1/32 steps), word3 reverse power noise
+
+// Board to ECB
+#define LOOPBACK_ID_CMD_ACK              0x180    // + board address, word3 is the register that was executed
+#define LOOPBACK_ID_STATUS               0x200    // + board address, word0 control, word1 fault, word2 warning, word3 not logged
+#define LOOPBACK_ID_LOG_DATA             0x280    // + frame (0-5), log_data[4*frame] to log_data[4*frame + 3]
+#define LOOPBACK_ID_DEBUG                0x2C0    // + frame (0-3), debug registers 4*frame to 4*frame + 3
+#define LOOPBACK_ID_PULSE_LOG            0x400    // + log register (ETMCanSlaveLogPulseData)
+#define LOOPBACK_ID_STATS                0x7F1    // Once a second, word0 frames sent, word1 frames received, word2 frames dropped (total), word3 bus load (0.1%)
+
+#define LOOPBACK_SYNC_RESET_ENABLE       0x0001
+#define LOOPBACK_SYNC_HIGH_SPEED_LOGGING 0x0002
+
+// Bus model
+#define LOOPBACK_CAN_BIT_RATE            1000000
+#define LOOPBACK_CAN_FRAME_BITS          125      // 8 byte standard frame with typical bit stuffing and the interframe space
+#define LOOPBACK_TX_QUEUE_SIZE           16       // Frames waiting for the bus, more are dropped and counted
+#define LOOPBACK_SYNC_TIMEOUT_US         250000   // Communication fault if there is no sync message for this long
+#define LOOPBACK_STATUS_PERIOD_US        100000   // Status and two slow log frames every 100mS
+#define LOOPBACK_STATS_PERIOD_US         1000000
+
+// Provided by host_hal.c
+unsigned long HostTimeMicroseconds(void);
+void HostSimulationService(void);
+void HostSimulationControl(unsigned int prf, unsigned int cold_resonance, unsigned int hot_shift, unsigned int noise);
+unsigned int HostPulseCount(void);
+
+#endif
@@ -0,0 +1,388 @@
+/*
+  Host stand-ins for the dsPIC special function registers, the ETM library and a simulated linac
+
+  Time is real time.  HostSimulationService() is called from ETMCanSlaveDoCan() on every pass of the main loop and
+  runs everything that has come due since the last pass in time order:
+    Timer 1 - _T1Interrupt() every (PR1 + 1) * 0.8uS while _T1IE is set
+    Timer 2 - TMR2 counts at 6.4uS (32 bits wide on the host so the firmware differences still work)
+    Timer 3 - _T3IF is set every 10mS
+    Pulses  - _INT0Interrupt() then _INT1Interrupt() at the simulated PRF
+
+  The simulated magnetron tunes with the motor position (the drive is assumed to never lose steps).
+  Reverse power is lowest at the resonance, which moves from the cold resonance by up to the hot shift as the
+  magnetron heats while pulsing and moves back as it cools.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../A37434.h"
+#include "etm_can_loopback.h"
+
+#define HOST_SFR(x) unsigned int x;
+HOST_SFR_LIST
+#undef HOST_SFR
+
+extern STEPPER_MOTOR afc_motor;
+
+void _T1Interrupt(void);
+void _INT0Interrupt(void);
+void _INT1Interrupt(void);
+
+#define HOST_T1_TICK_NS               ((1000000000ULL * 8) / FCY_CLK)        // T1 prescale is 1:8
+#define HOST_T3_PERIOD_US             10000
+#define HOST_MAX_LAG_US               50000    // Further behind than this (debugger, host load) and the simulation skips ahead
+#define HOST_T1_CALLS_PER_SERVICE     64
+
+#define SIM_REVERSE_FLOOR             2000     // External ADC counts at the resonance
+#define SIM_REVERSE_SPAN              40000    // External ADC counts added far from the resonance
+#define SIM_RESONANCE_WIDTH           2500     // 1/32 steps to half of the span
+#define SIM_FORWARD                   30000
+#define SIM_HEAT_TIME_CONSTANT        60.0     // Seconds
+#define SIM_COOL_TIME_CONSTANT        300.0
+
+#define SIM_DEFAULT_RESONANCE         28000
+#define SIM_DEFAULT_HOT_SHIFT         (-600)
+#define SIM_DEFAULT_NOISE             20       // +/- counts, close to the detector.  Far above MINIMUM_REV_PWR_CHANGE (3 to 7) the fast mode votes are random
+
+typedef struct {
+  unsigned long long start_ns;
+  unsigned long long now_us;                     // Time of the event being serviced
+
+  unsigned long long next_t1_ns;
+  unsigned long long next_t3_us;
+  unsigned long long next_pulse_us;
+
+  unsigned int  prf;
+  unsigned int  cold_resonance;
+  signed int    hot_shift;
+  unsigned int  noise;
+  double        heat;                            // 0 cold, 1 fully hot
+  unsigned long long last_heat_us;
+  unsigned int  pulse_count;
+  unsigned long random_state;
+
+  FILE*         eeprom_file;
+} TYPE_HOST_SIMULATION;
+
+static TYPE_HOST_SIMULATION sim = {
+  .cold_resonance = SIM_DEFAULT_RESONANCE,
+  .hot_shift = SIM_DEFAULT_HOT_SHIFT,
+  .noise = SIM_DEFAULT_NOISE,
+  .random_state = 1,
+};
+
+static unsigned long long HostRealTimeNanoseconds(void);
+static void HostStartClock(void);
+static void HostUpdateHeat(unsigned long long now_us);
+static void HostPulse(void);
+static unsigned int HostReversePower(void);
+static unsigned int HostNoise(void);
+
+
+unsigned long HostTimeMicroseconds(void) {
+  HostStartClock();
+  return (unsigned long)((HostRealTimeNanoseconds() - sim.start_ns) / 1000);
+}
+
+
+unsigned int HostPulseCount(void) {
+  return sim.pulse_count;
+}
+
+
+void HostSimulationControl(unsigned int prf, unsigned int cold_resonance, unsigned int hot_shift, unsigned int noise) {
+  HostUpdateHeat(sim.now_us);
+  if (prf && (sim.prf == 0)) {
+    sim.next_pulse_us = sim.now_us + 1000000 / prf;
+  }
+  sim.prf = prf;
+  sim.cold_resonance = cold_resonance;
+  sim.hot_shift = (signed short)hot_shift;
+  sim.noise = noise;
+}
+
+
+void HostSimulationService(void) {
+  unsigned long long now_ns;
+  unsigned long long now_us;
+  unsigned long long t1_us;
+  unsigned int t1_calls;
+
+  HostStartClock();
+  now_ns = HostRealTimeNanoseconds() - sim.start_ns;
+  now_us = now_ns / 1000;
+
+  if ((now_us - sim.now_us) > HOST_MAX_LAG_US) {
+    sim.now_us = now_us;
+    sim.next_t1_ns = now_ns;
+    if (sim.next_t3_us < now_us) {
+      sim.next_t3_us = now_us;
+    }
+    if (sim.prf && (sim.next_pulse_us < now_us)) {
+      sim.next_pulse_us = now_us;
+    }
+  }
+
+  if (!_T1IE) {
+    // Timer 1 does not run up a backlog while the interrupt is held off
+    if (sim.next_t1_ns < now_ns) {
+      sim.next_t1_ns = now_ns;
+    }
+  }
+
+  t1_calls = 0;
+  while (1) {
+    t1_us = sim.next_t1_ns / 1000;
+    if (sim.prf && (sim.next_pulse_us <= now_us) && (sim.next_pulse_us <= t1_us) && (sim.next_pulse_us <= sim.next_t3_us)) {
+      sim.now_us = sim.next_pulse_us;
+      sim.next_pulse_us += 1000000 / sim.prf;
+      TMR2 = (unsigned int)(sim.now_us * 10 / 64);
+      HostPulse();
+    } else if ((sim.next_t3_us <= now_us) && (sim.next_t3_us <= t1_us)) {
+      sim.now_us = sim.next_t3_us;
+      sim.next_t3_us += HOST_T3_PERIOD_US;
+      _T3IF = 1;
+    } else if (_T1IE && (sim.next_t1_ns <= now_ns) && (t1_calls < HOST_T1_CALLS_PER_SERVICE)) {
+      sim.now_us = t1_us;
+      TMR2 = (unsigned int)(sim.now_us * 10 / 64);
+      _T1IF = 1;
+      _T1Interrupt();
+      sim.next_t1_ns += (PR1 + 1) * HOST_T1_TICK_NS;
+      t1_calls++;
+    } else {
+      break;
+    }
+  }
+
+  sim.now_us = now_us;
+  TMR2 = (unsigned int)(now_us * 10 / 64);
+  HostUpdateHeat(now_us);
+}
+
+
+static void HostStartClock(void) {
+  if (sim.start_ns == 0) {
+    sim.start_ns = HostRealTimeNanoseconds() - 1;
+    PIN_MOTOR_DRV_INPUT_NOT_FAULT = 1;
+  }
+}
+
+
+static unsigned long long HostRealTimeNanoseconds(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+static void HostUpdateHeat(unsigned long long now_us) {
+  double seconds;
+
+  seconds = (now_us - sim.last_heat_us) / 1000000.0;
+  sim.last_heat_us = now_us;
+  if (sim.prf) {
+    sim.heat = 1.0 - (1.0 - sim.heat) * exp(-seconds / SIM_HEAT_TIME_CONSTANT);
+  } else {
+    sim.heat *= exp(-seconds / SIM_COOL_TIME_CONSTANT);
+  }
+}
+
+
+static void HostPulse(void) {
+  unsigned int reverse;
+
+  sim.pulse_count++;
+  HostUpdateHeat(sim.now_us);
+
+  // The internal ADC is converted by the trigger, the external ADCs are read by _INT1Interrupt
+  reverse = HostReversePower();
+  ADCBUF1 = reverse >> 6;
+  ADCBUF2 = SIM_FORWARD >> 6;
+
+  if (_INT0IE) {
+    _INT0IF = 1;
+    _INT0Interrupt();
+  }
+  if (_INT1IE) {
+    _INT1IF = 1;
+    _INT1Interrupt();
+  }
+}
+
+
+static unsigned int HostNoise(void) {
+  sim.random_state = sim.random_state * 1103515245UL + 12345UL;
+  if (sim.noise == 0) {
+    return 0;
+  }
+  return (unsigned int)((sim.random_state >> 8) % (2 * sim.noise + 1));
+}
+
+
+static unsigned int HostReversePower(void) {
+  double resonance;
+  double detune;
+  double power;
+
+  resonance = sim.cold_resonance + sim.hot_shift * sim.heat;
+  detune = POSITION_TO_32NDS(afc_motor.current_position) - resonance;
+  power = SIM_REVERSE_FLOOR + SIM_REVERSE_SPAN * detune * detune / (detune * detune + SIM_RESONANCE_WIDTH * SIM_RESONANCE_WIDTH);
+  power += (signed int)HostNoise() - (signed int)sim.noise;
+  if (power < 0) {
+    power = 0;
+  }
+  if (power > 0xFFFF) {
+    power = 0xFFFF;
+  }
+  return (unsigned int)power;
+}
+
+
+// -------------------- ETM library stand-ins -------------------- //
+
+void ETMAnalogInitializeInput(AnalogInput* ptr, unsigned int fixed_scale, signed int fixed_offset, unsigned char analog_port,
+			      unsigned int over_trip_point_absolute, unsigned int under_trip_point_absolute,
+			      unsigned int relative_trip_point_scale, unsigned int relative_trip_point_floor,
+			      unsigned int relative_counter_fault_limit, unsigned int absolute_counter_fault_limit) {
+  memset(ptr, 0, sizeof(AnalogInput));
+  ptr->fixed_scale = fixed_scale;
+  ptr->fixed_offset = fixed_offset;
+  ptr->calibration_internal_scale = MACRO_DEC_TO_CAL_FACTOR_2(1);
+  ptr->calibration_external_scale = MACRO_DEC_TO_CAL_FACTOR_2(1);
+}
+
+
+void ETMAnalogScaleCalibrateADCReading(AnalogInput* ptr) {
+  long value;
+
+  value = ((long)ptr->filtered_adc_reading * ptr->fixed_scale) >> 12;
+  value += ptr->fixed_offset;
+  value = (value * ptr->calibration_internal_scale) >> 15;
+  value += ptr->calibration_internal_offset;
+  value = (value * ptr->calibration_external_scale) >> 15;
+  value += ptr->calibration_external_offset;
+  if (value < 0) {
+    value = 0;
+  }
+  if (value > 0xFFFF) {
+    value = 0xFFFF;
+  }
+  ptr->reading_scaled_and_calibrated = value;
+}
+
+
+unsigned int ETMMath16Add(unsigned int value_1, unsigned int value_2) {
+  if ((value_1 + value_2) > 0xFFFF) {
+    return 0xFFFF;
+  }
+  return value_1 + value_2;
+}
+
+
+unsigned int ETMMath16Sub(unsigned int value_1, unsigned int value_2) {
+  if (value_2 > value_1) {
+    return 0;
+  }
+  return value_1 - value_2;
+}
+
+
+void __delay32(unsigned long cycles) {
+}
+
+
+void ETMEEPromUseExternal(void) {
+}
+
+
+void ETMEEPromConfigureExternalDevice(unsigned int size_bytes, unsigned long fcy_clk, unsigned long i2c_baud_rate, unsigned char i2c_address, unsigned char i2c_port) {
+  const char* file_name;
+  unsigned char blank[EEPROM_SIZE_8K_BYTES];
+
+  file_name = getenv("A37434_EEPROM_FILE");
+  if (file_name == 0) {
+    file_name = "a37434_eeprom.bin";
+  }
+  sim.eeprom_file = fopen(file_name, "r+b");
+  if (sim.eeprom_file == 0) {
+    // A new EEPROM is erased to 0xFF
+    sim.eeprom_file = fopen(file_name, "w+b");
+    if (sim.eeprom_file) {
+      memset(blank, 0xFF, sizeof(blank));
+      fwrite(blank, 1, sizeof(blank), sim.eeprom_file);
+      fflush(sim.eeprom_file);
+    }
+  }
+}
+
+
+unsigned int ETMEEPromCheckOK(void) {
+  return (sim.eeprom_file != 0);
+}
+
+
+unsigned int ETMEEPromWritePage(unsigned int page_number, unsigned int* data) {
+  unsigned char bytes[32];
+  unsigned int n;
+
+  if ((sim.eeprom_file == 0) || (page_number >= (EEPROM_SIZE_8K_BYTES / 32))) {
+    return 0;
+  }
+  for (n = 0; n < 16; n++) {
+    bytes[2*n] = data[n];
+    bytes[2*n + 1] = data[n] >> 8;
+  }
+  fseek(sim.eeprom_file, page_number * 32, SEEK_SET);
+  fwrite(bytes, 1, sizeof(bytes), sim.eeprom_file);
+  fflush(sim.eeprom_file);
+  return 1;
+}
+
+
+unsigned int ETMEEPromReadPage(unsigned int page_number, unsigned int* data) {
+  unsigned char bytes[32];
+  unsigned int n;
+
+  if ((sim.eeprom_file == 0) || (page_number >= (EEPROM_SIZE_8K_BYTES / 32))) {
+    return 0;
+  }
+  fseek(sim.eeprom_file, page_number * 32, SEEK_SET);
+  if (fread(bytes, 1, sizeof(bytes), sim.eeprom_file) != sizeof(bytes)) {
+    return 0;
+  }
+  for (n = 0; n < 16; n++) {
+    data[n] = bytes[2*n] | (bytes[2*n + 1] << 8);
+  }
+  return 1;
+}
+
+
+void SetupMCP4725(MCP4725* ptr, unsigned char i2c_port, unsigned char address, unsigned long fcy_clk, unsigned long i2c_baud_rate) {
+  ptr->value = 0;
+}
+
+
+unsigned int MCP4725UpdateFast(MCP4725* ptr, unsigned int value) {
+  ptr->value = value;
+  return 0;
+}
+
+
+void ConfigureSPI(unsigned char spi_port, unsigned int spicon_value, unsigned int spicon2_value, unsigned int spistat_value, unsigned long bit_rate, unsigned long fcy_clk) {
+}
+
+
+unsigned long SendAndReceiveSPI(unsigned int data_word, unsigned char spi_port) {
+  // The ADC that is selected is the one that answers
+  if (PIN_INPUT_A_CS == OLL_SELECT_ADC) {
+    return HostReversePower();
+  }
+  if (PIN_INPUT_B_CS == OLL_SELECT_ADC) {
+    return SIM_FORWARD + HostNoise();
+  }
+  return 0x11110000;
+}
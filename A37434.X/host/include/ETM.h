@@ -0,0 +1,70 @@
+/*
+  Host build stand-in for the ETM library header (analog inputs, EEPROM, DAC and SPI)
+  Implemented by host/host_hal.c
+*/
+#ifndef __HOST_ETM_H
+#define __HOST_ETM_H
+
+typedef struct {
+  unsigned int filtered_adc_reading;
+  unsigned int reading_scaled_and_calibrated;
+  unsigned int fixed_scale;                      // 1 = 0x1000 (maximum 16)
+  signed int   fixed_offset;
+  unsigned int calibration_internal_scale;       // 1 = 0x8000 (maximum 2)
+  signed int   calibration_internal_offset;
+  unsigned int calibration_external_scale;
+  signed int   calibration_external_offset;
+} AnalogInput;
+
+#define MACRO_DEC_TO_SCALE_FACTOR_16(x)          ((unsigned int)((x)*4096))
+#define MACRO_DEC_TO_CAL_FACTOR_2(x)             ((unsigned int)((x)*32768))
+#define OFFSET_ZERO                              0
+#define ANALOG_INPUT_NO_CALIBRATION              0xFF
+#define NO_OVER_TRIP                             0xFFFF
+#define NO_UNDER_TRIP                            0
+#define NO_TRIP_SCALE                            0
+#define NO_FLOOR                                 0
+#define NO_COUNTER                               0
+
+void ETMAnalogInitializeInput(AnalogInput* ptr, unsigned int fixed_scale, signed int fixed_offset, unsigned char analog_port,
+			      unsigned int over_trip_point_absolute, unsigned int under_trip_point_absolute,
+			      unsigned int relative_trip_point_scale, unsigned int relative_trip_point_floor,
+			      unsigned int relative_counter_fault_limit, unsigned int absolute_counter_fault_limit);
+void ETMAnalogScaleCalibrateADCReading(AnalogInput* ptr);
+
+
+// EEPROM - kept in a file on the host (A37434_EEPROM_FILE, default a37434_eeprom.bin)
+#define EEPROM_SIZE_8K_BYTES                     8192
+#define ETM_I2C_400K_BAUD                        400000
+#define EEPROM_I2C_ADDRESS_0                     0
+#define I2C_PORT_1                               1
+
+void ETMEEPromUseExternal(void);
+void ETMEEPromConfigureExternalDevice(unsigned int size_bytes, unsigned long fcy_clk, unsigned long i2c_baud_rate, unsigned char i2c_address, unsigned char i2c_port);
+unsigned int ETMEEPromCheckOK(void);
+unsigned int ETMEEPromWritePage(unsigned int page_number, unsigned int* data);
+unsigned int ETMEEPromReadPage(unsigned int page_number, unsigned int* data);
+
+
+// DAC
+typedef struct {
+  unsigned int value;
+} MCP4725;
+
+#define MCP4725_ADDRESS_A0_0                     0
+
+void SetupMCP4725(MCP4725* ptr, unsigned char i2c_port, unsigned char address, unsigned long fcy_clk, unsigned long i2c_baud_rate);
+unsigned int MCP4725UpdateFast(MCP4725* ptr, unsigned int value);
+
+
+// SPI - The external ADC readings come from the simulated magnetron
+#define ETM_SPI_PORT_2                           2
+#define ETM_DEFAULT_SPI_CON_VALUE                0
+#define ETM_DEFAULT_SPI_CON2_VALUE               0
+#define ETM_DEFAULT_SPI_STAT_VALUE               0
+#define SPI_CLK_2_MBIT                           2000000
+
+void ConfigureSPI(unsigned char spi_port, unsigned int spicon_value, unsigned int spicon2_value, unsigned int spistat_value, unsigned long bit_rate, unsigned long fcy_clk);
+unsigned long SendAndReceiveSPI(unsigned int data_word, unsigned char spi_port);
+
+#endif
@@ -0,0 +1,8 @@
+// Host build stand-in for the ETM math library header
+#ifndef __HOST_ETM_MATH_H
+#define __HOST_ETM_MATH_H
+
+unsigned int ETMMath16Add(unsigned int value_1, unsigned int value_2);  // Saturates at 0xFFFF
+unsigned int ETMMath16Sub(unsigned int value_1, unsigned int value_2);  // Saturates at 0
+
+#endif
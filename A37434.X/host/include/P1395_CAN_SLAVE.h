@@ -0,0 +1,97 @@
+/*
+  Host build stand-in for the ETM P1395 CAN slave library header
+  The API is implemented over UDP by host/etm_can_loopback.c
+
+  The register and log IDs below are only used between the host build and host/ecb_client.py
+  (the client reads them from this file).  They are not the values used by the ECB on the CAN bus.
+*/
+#ifndef __HOST_P1395_CAN_SLAVE_H
+#define __HOST_P1395_CAN_SLAVE_H
+
+typedef struct {
+  unsigned int identifier;
+  unsigned int word0;
+  unsigned int word1;
+  unsigned int word2;
+  unsigned int word3;
+} ETMCanMessage;
+
+#define SLAVE_LOG_DATA_WORDS                                 24
+
+typedef struct {
+  unsigned int log_data[SLAVE_LOG_DATA_WORDS];
+  unsigned int debug_data[16];
+} ETMCanBoardData;
+
+extern ETMCanBoardData slave_board_data;
+
+
+// Status and fault registers, sent in the status message
+typedef union {
+  unsigned int word;
+  struct {
+    unsigned int control_not_ready:1;
+    unsigned int control_not_configured:1;
+    unsigned int unused:6;
+    unsigned int logged_0:1;
+    unsigned int logged_1:1;
+    unsigned int logged_2:1;
+    unsigned int logged_3:1;
+    unsigned int logged_4:1;
+    unsigned int logged_5:1;
+    unsigned int logged_6:1;
+    unsigned int logged_7:1;
+  } bits;
+} ETMCanStatusRegister;
+
+extern ETMCanStatusRegister etm_can_control_register;
+extern ETMCanStatusRegister etm_can_fault_register;
+extern unsigned int etm_can_warning_register;
+extern unsigned int etm_can_not_logged_register;
+
+#define _CONTROL_REGISTER                                    etm_can_control_register.word
+#define _CONTROL_NOT_READY                                   etm_can_control_register.bits.control_not_ready
+#define _CONTROL_NOT_CONFIGURED                              etm_can_control_register.bits.control_not_configured
+#define _LOGGED_STATUS_0                                     etm_can_control_register.bits.logged_0
+#define _LOGGED_STATUS_1                                     etm_can_control_register.bits.logged_1
+#define _LOGGED_STATUS_2                                     etm_can_control_register.bits.logged_2
+#define _LOGGED_STATUS_3                                     etm_can_control_register.bits.logged_3
+#define _LOGGED_STATUS_4                                     etm_can_control_register.bits.logged_4
+#define _LOGGED_STATUS_5                                     etm_can_control_register.bits.logged_5
+#define _FAULT_REGISTER                                      etm_can_fault_register.word
+#define _LOGGED_FAULT_0                                      etm_can_fault_register.bits.logged_0
+#define _LOGGED_FAULT_1                                      etm_can_fault_register.bits.logged_1
+#define _LOGGED_FAULT_2                                      etm_can_fault_register.bits.logged_2
+#define _WARNING_REGISTER                                    etm_can_warning_register
+#define _NOT_LOGGED_REGISTER                                 etm_can_not_logged_register
+
+
+#define CAN_PORT_1                                           1
+#define ETM_CAN_ADDR_AFC_CONTROL_BOARD                       5
+#define _PIN_RD10                                            0
+#define _PIN_RD9                                             0
+
+#define ETM_CAN_REGISTER_AFC_SET_1_HOME_POSITION_AND_OFFSET  0x5100
+#define ETM_CAN_REGISTER_AFC_CMD_SELECT_AFC_MODE             0x5181
+#define ETM_CAN_REGISTER_AFC_CMD_SELECT_MANUAL_MODE          0x5182
+#define ETM_CAN_REGISTER_AFC_CMD_SET_MANUAL_TARGET_POSITION  0x5183
+#define ETM_CAN_REGISTER_AFC_CMD_RELATIVE_MOVE_MANUAL_TARGET 0x5184
+
+#define ETM_CAN_DATA_LOG_REGISTER_AFC_FAST_LOG_0             0x50
+#define ETM_CAN_DATA_LOG_REGISTER_AFC_FAST_LOG_1             0x51
+
+
+void ETMCanSlaveInitialize(unsigned int requested_can_port, unsigned long fcy, unsigned int address, unsigned long can_operation_led, unsigned int can_interrupt_priority, unsigned long flash_led, unsigned long not_ready_led);
+void ETMCanSlaveLoadConfiguration(unsigned long agile_id, unsigned int agile_dash, unsigned int firmware_agile_rev, unsigned int firmware_branch, unsigned int firmware_branch_rev);
+void ETMCanSlaveDoCan(void);
+void ETMCanSlaveLogPulseData(unsigned int packet_id, unsigned int word3, unsigned int word2, unsigned int word1, unsigned int word0);
+void ETMCanSlaveSetDebugRegister(unsigned int debug_register, unsigned int debug_value);
+unsigned int ETMCanSlaveGetComFaultStatus(void);
+unsigned int ETMCanSlaveGetSyncMsgResetEnable(void);
+unsigned int ETMCanSlaveGetSyncMsgHighSpeedLogging(void);
+unsigned int ETMCanSlaveGetPulseCount(void);
+
+// Implemented by the board firmware
+void ETMCanSlaveExecuteCMDBoardSpecific(ETMCanMessage* message_ptr);
+
+#endif
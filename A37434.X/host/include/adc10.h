@@ -0,0 +1,48 @@
+// Host build stand-in for the XC16 peripheral library header, the values are not used on the host
+#ifndef __HOST_ADC10_H
+#define __HOST_ADC10_H
+
+#define ADC_MODULE_ON 0xFFFF
+#define ADC_IDLE_STOP 0xFFFF
+#define ADC_FORMAT_INTG 0xFFFF
+#define ADC_CLK_INT0 0xFFFF
+#define ADC_CLK_AUTO 0xFFFF
+#define ADC_SAMPLE_SIMULTANEOUS 0xFFFF
+#define ADC_AUTO_SAMPLING_ON 0xFFFF
+#define ADC_VREF_EXT_EXT 0xFFFF
+#define ADC_SCAN_ON 0xFFFF
+#define ADC_CONVERT_CH_0ABC 0xFFFF
+#define ADC_SAMPLES_PER_INT_12 0xFFFF
+#define ADC_ALT_BUF_OFF 0xFFFF
+#define ADC_ALT_INPUT_ON 0xFFFF
+#define ADC_SAMPLE_TIME_10 0xFFFF
+#define ADC_CONV_CLK_SYSTEM 0xFFFF
+#define ADC_CONV_CLK_2Tcy 0xFFFF
+#define ADC_CHX_POS_SAMPLEA_AN3AN4AN5 0xFFFF
+#define ADC_CHX_NEG_SAMPLEA_VREFN 0xFFFF
+#define ADC_CH0_POS_SAMPLEA_AN13 0xFFFF
+#define ADC_CH0_NEG_SAMPLEA_VREFN 0xFFFF
+#define ADC_CHX_POS_SAMPLEB_AN3AN4AN5 0xFFFF
+#define ADC_CHX_NEG_SAMPLEB_VREFN 0xFFFF
+#define ADC_CH0_POS_SAMPLEB_AN14 0xFFFF
+#define ADC_CH0_NEG_SAMPLEB_VREFN 0xFFFF
+#define ENABLE_AN3_ANA 0xFFFF
+#define ENABLE_AN4_ANA 0xFFFF
+#define ENABLE_AN9_ANA 0xFFFF
+#define ENABLE_AN13_ANA 0xFFFF
+#define ENABLE_AN14_ANA 0xFFFF
+#define SKIP_SCAN_AN0 0xFFFF
+#define SKIP_SCAN_AN1 0xFFFF
+#define SKIP_SCAN_AN2 0xFFFF
+#define SKIP_SCAN_AN3 0xFFFF
+#define SKIP_SCAN_AN4 0xFFFF
+#define SKIP_SCAN_AN5 0xFFFF
+#define SKIP_SCAN_AN6 0xFFFF
+#define SKIP_SCAN_AN7 0xFFFF
+#define SKIP_SCAN_AN8 0xFFFF
+#define SKIP_SCAN_AN10 0xFFFF
+#define SKIP_SCAN_AN11 0xFFFF
+#define SKIP_SCAN_AN12 0xFFFF
+#define SKIP_SCAN_AN15 0xFFFF
+
+#endif
@@ -0,0 +1,7 @@
+// Host build stand-in for libpic30.h
+#ifndef __HOST_LIBPIC30_H
+#define __HOST_LIBPIC30_H
+
+void __delay32(unsigned long cycles);
+
+#endif
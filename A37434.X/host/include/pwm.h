@@ -0,0 +1,52 @@
+// Host build stand-in for the XC16 peripheral library header, the values are not used on the host
+#ifndef __HOST_PWM_H
+#define __HOST_PWM_H
+
+#define PWM_EN 0xFFFF
+#define PWM_IPCLK_SCALE1 0xFFFF
+#define PWM_MOD_FREE 0xFFFF
+#define PWM_MOD1_COMP 0xFFFF
+#define PWM_MOD2_COMP 0xFFFF
+#define PWM_MOD3_COMP 0xFFFF
+#define PWM_MOD4_COMP 0xFFFF
+#define PWM_PEN1H 0xFFFF
+#define PWM_PEN1L 0xFFFF
+#define PWM_PEN2H 0xFFFF
+#define PWM_PEN2L 0xFFFF
+#define PWM_PEN3H 0xFFFF
+#define PWM_PEN3L 0xFFFF
+#define PWM_PEN4H 0xFFFF
+#define PWM_PEN4L 0xFFFF
+#define PWM_SEVOPS1 0xFFFF
+#define PWM_OSYNC_TCY 0xFFFF
+#define PWM_UEN 0xFFFF
+#define PWM_DTAPS1 0xFFFF
+#define PWM_DTA0 0xFFFF
+#define PWM_DTBPS1 0xFFFF
+#define PWM_DTB0 0xFFFF
+#define PWM_DTS1A_UA 0xFFFF
+#define PWM_DTS1I_UA 0xFFFF
+#define PWM_DTS2A_UA 0xFFFF
+#define PWM_DTS2I_UA 0xFFFF
+#define PWM_DTS3A_UA 0xFFFF
+#define PWM_DTS3I_UA 0xFFFF
+#define PWM_DTS4A_UA 0xFFFF
+#define PWM_DTS4I_UA 0xFFFF
+#define PWM_FLTA1_DIS 0xFFFF
+#define PWM_FLTA2_DIS 0xFFFF
+#define PWM_FLTA3_DIS 0xFFFF
+#define PWM_FLTA4_DIS 0xFFFF
+#define PWM_FLTB1_DIS 0xFFFF
+#define PWM_FLTB2_DIS 0xFFFF
+#define PWM_FLTB3_DIS 0xFFFF
+#define PWM_FLTB4_DIS 0xFFFF
+#define PWM_GEN_1H 0xFFFF
+#define PWM_GEN_1L 0xFFFF
+#define PWM_GEN_2H 0xFFFF
+#define PWM_GEN_2L 0xFFFF
+#define PWM_GEN_3H 0xFFFF
+#define PWM_GEN_3L 0xFFFF
+#define PWM_GEN_4H 0xFFFF
+#define PWM_GEN_4L 0xFFFF
+
+#endif
@@ -0,0 +1,23 @@
+// Host build stand-in for the XC16 peripheral library header, the values are not used on the host
+#ifndef __HOST_TIMER_H
+#define __HOST_TIMER_H
+
+#define T1_ON 0xFFFF
+#define T1_IDLE_CON 0xFFFF
+#define T1_GATE_OFF 0xFFFF
+#define T1_PS_1_8 0xFFFF
+#define T1_SYNC_EXT_OFF 0xFFFF
+#define T1_SOURCE_INT 0xFFFF
+#define T2_ON 0xFFFF
+#define T2_IDLE_CON 0xFFFF
+#define T2_GATE_OFF 0xFFFF
+#define T2_PS_1_64 0xFFFF
+#define T2_32BIT_MODE_OFF 0xFFFF
+#define T2_SOURCE_INT 0xFFFF
+#define T3_ON 0xFFFF
+#define T3_IDLE_CON 0xFFFF
+#define T3_GATE_OFF 0xFFFF
+#define T3_PS_1_8 0xFFFF
+#define T3_SOURCE_INT 0xFFFF
+
+#endif
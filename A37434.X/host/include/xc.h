@@ -0,0 +1,49 @@
+// Host build stand-in for the XC16 device header
+// The special function registers used by the firmware are plain variables, defined in host_hal.c
+#ifndef __HOST_XC_H
+#define __HOST_XC_H
+
+#define HOST_SFR_LIST \
+  HOST_SFR(TRISA) HOST_SFR(TRISB) HOST_SFR(TRISC) HOST_SFR(TRISD) HOST_SFR(TRISE) HOST_SFR(TRISF) HOST_SFR(TRISG) \
+  HOST_SFR(PR1) HOST_SFR(PR2) HOST_SFR(PR3) HOST_SFR(T1CON) HOST_SFR(T2CON) HOST_SFR(T3CON) \
+  HOST_SFR(TMR1) HOST_SFR(TMR2) HOST_SFR(TMR3) \
+  HOST_SFR(PTPER) HOST_SFR(PWMCON1) HOST_SFR(PWMCON2) HOST_SFR(DTCON1) HOST_SFR(DTCON2) \
+  HOST_SFR(FLTACON) HOST_SFR(FLTBCON) HOST_SFR(OVDCON) HOST_SFR(PTCON) \
+  HOST_SFR(PDC1) HOST_SFR(PDC2) HOST_SFR(PDC3) HOST_SFR(PDC4) \
+  HOST_SFR(_PSV) HOST_SFR(PSVPAG) HOST_SFR(CORCON) \
+  HOST_SFR(ADCON1) HOST_SFR(ADCON2) HOST_SFR(ADCON3) HOST_SFR(ADCHS) HOST_SFR(ADPCFG) HOST_SFR(ADCSSL) \
+  HOST_SFR(ADCBUF0) HOST_SFR(ADCBUF1) HOST_SFR(ADCBUF2) HOST_SFR(ADCBUF3) HOST_SFR(ADCBUF4) HOST_SFR(ADCBUF5) \
+  HOST_SFR(ADCBUF6) HOST_SFR(ADCBUF7) HOST_SFR(ADCBUF8) HOST_SFR(ADCBUF9) HOST_SFR(ADCBUFA) HOST_SFR(ADCBUFB) \
+  HOST_SFR(ADCBUFC) HOST_SFR(ADCBUFD) HOST_SFR(ADCBUFE) HOST_SFR(ADCBUFF) \
+  HOST_SFR(_T1IF) HOST_SFR(_T1IP) HOST_SFR(_T1IE) HOST_SFR(_T2IF) HOST_SFR(_T2IE) HOST_SFR(_T3IF) \
+  HOST_SFR(_INT0IF) HOST_SFR(_INT0IP) HOST_SFR(_INT0IE) HOST_SFR(_INT0EP) \
+  HOST_SFR(_INT1IF) HOST_SFR(_INT1IP) HOST_SFR(_INT1IE) HOST_SFR(_INT1EP) \
+  HOST_SFR(_LATD3) HOST_SFR(_LATD2) HOST_SFR(_LATD12) HOST_SFR(_TRISD12) HOST_SFR(_LATC14) HOST_SFR(_LATC13) \
+  HOST_SFR(_LATD0) HOST_SFR(_LATD11) HOST_SFR(_RD1) \
+  HOST_SFR(_LATC1) HOST_SFR(_LATC3) HOST_SFR(_LATD6) HOST_SFR(_LATG1) HOST_SFR(_LATG0) HOST_SFR(_TRISG1) \
+  HOST_SFR(_LATB10) HOST_SFR(_LATB11) HOST_SFR(_RG7)
+
+#define HOST_SFR(x) extern unsigned int x;
+HOST_SFR_LIST
+#undef HOST_SFR
+
+// Configuration bits and device builtins
+#define _FOSC(x)
+#define _FWDT(x)
+#define _FBORPOR(x)
+#define _FBS(x)
+#define _FSS(x)
+#define _FGS(x)
+#define _FICD(x)
+#define __builtin_psvpage(x)   0
+#define __builtin_psvoffset(x) 0
+#define Nop()
+#define ClrWdt()
+
+// interrupt, no_auto_psv and space(psv) have no meaning on the host
+#define __attribute__(x)
+
+// The only inline assembly is the reset in _DefaultInterrupt, which has no vector on the host
+#define __asm__(x)
+
+#endif
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""
+Generates A37434_TABLES.h - the motor PWM tables and the cooldown curve knots.
+
+The tables used to be pasted from spreadsheets.  They are now calculated from
+the named parameters below, so retuning the drive current or the cooldown for
+a different magnetron is a parameter change followed by "make tables".
+
+  python tools/generate_tables.py           write A37434_TABLES.h
+  python tools/generate_tables.py --check   exit 1 if A37434_TABLES.h does not match the parameters
+
+The PWM period is read from A37434.h (FCY_CLK / MOTOR_PWM_FREQ) so the duty
+counts follow a change of PWM frequency.
+
+Only the standard library is used so this runs wherever MPLAB X runs make.
+"""
+
+import argparse
+import math
+import os
+import re
+import sys
+
+
+# ---------------- Motor drive parameters ----------------
+# Currents are a percentage of the drive full scale current (supply voltage / winding resistance)
+PWM_MINIMUM_PERCENT = 5           # Duty applied to a winding at zero current, also the second half of the cycle
+RUN_CURRENT_PERCENT = 53          # Peak current while the motor is moving (PWMHighPowerTable)
+HOLD_CURRENT_PERCENT = 30         # Peak current while the motor is holding position (PWMLowPowerTable)
+MICROSTEP_RESOLUTIONS = (32, 64, 128)
+PLATEAU_MICROSTEPS = {32: 8, 64: 1, 128: 1}   # The 1/32 tables have 1/4 step plateaus (must match PWM_TABLE_PLATEAU_SHIFT)
+
+
+# ---------------- Cooldown parameters ----------------
+# The tuning drift after the magnetron stops is the sum of thermal time constants
+# multiplier(t) = sum(fraction * exp(-t / time_constant)), limited to COOLDOWN_MAX_SCALE
+COOLDOWN_TERMS = (
+    # (fraction of the hot to home shift, time constant in seconds)
+    (0.20, 12.0),                 # Anode vanes
+    (0.40, 90.0),                 # Anode block
+    (0.45, 600.0),                # Cooling jacket and water
+)
+COOLDOWN_MAX_SCALE = 0.95         # The motor never starts the cooldown beyond the hot position
+COOLDOWN_SLOT_SECONDS = 5.12      # Length of one cooldown index (time_off_counter >> 9 at 10mS)
+COOLDOWN_DURATION_SECONDS = 1167  # The multiplier is zero from here on (COOL_DOWN_END_INDEX)
+COOLDOWN_KNOT_OCTAVES = (3, 8)    # Knots at every index below 8, then 4 per octave up to 2^8 (see CoolDownValue())
+
+
+HEADER_NAME = "A37434_TABLES.h"
+Q15_ONE = 32768
+
+
+def read_define(header_text, name):
+    match = re.search(r"^#define\s+%s\s+(\d+)" % name, header_text, re.MULTILINE)
+    if match is None:
+        sys.exit("generate_tables: %s not found in A37434.h" % name)
+    return int(match.group(1))
+
+
+def pwm_quarter_table(ptper, microsteps, peak_percent):
+    # Duty cycle is encoded at twice the resolution of the period, so full scale is 2 * PTPER
+    full_scale = 2 * ptper
+    minimum = full_scale * PWM_MINIMUM_PERCENT / 100.0
+    peak = full_scale * peak_percent / 100.0
+    half_cycle = microsteps * 2
+    plateau = PLATEAU_MICROSTEPS[microsteps]
+    entries = (microsteps // plateau) + 1
+    return [int(math.floor(minimum + peak * math.sin(math.pi * n * plateau / half_cycle) + 0.5)) for n in range(entries)]
+
+
+def cooldown_scale(index):
+    seconds = index * COOLDOWN_SLOT_SECONDS
+    scale = sum(fraction * math.exp(-seconds / time_constant) for fraction, time_constant in COOLDOWN_TERMS)
+    return int(math.floor(min(scale, COOLDOWN_MAX_SCALE) * Q15_ONE + 0.5))
+
+
+def cooldown_knot_positions():
+    first_octave, last_octave = COOLDOWN_KNOT_OCTAVES
+    positions = list(range(1 << first_octave))
+    for octave in range(first_octave, last_octave):
+        spacing = 1 << (octave - 2)
+        positions += [(1 << octave) + k * spacing for k in range(4)]
+    positions.append(1 << last_octave)
+    return positions
+
+
+def cooldown_knots(end_index):
+    knots = []
+    positions = cooldown_knot_positions()
+    for n, position in enumerate(positions):
+        if position < end_index:
+            knots.append(cooldown_scale(position))
+        else:
+            # Past the end of the curve, continue the line from the previous knot through the last index in use
+            previous = positions[n - 1]
+            slope = (cooldown_scale(end_index - 1) - knots[-1]) / float(end_index - 1 - previous)
+            knots.append(max(0, int(math.floor(knots[-1] + slope * (position - previous) + 0.5))))
+            break
+    return positions[:len(knots)], knots
+
+
+def interpolation_error(positions, knots, end_index):
+    worst = 0
+    for index in range(end_index):
+        for n in range(len(positions) - 1):
+            if positions[n] <= index < positions[n + 1]:
+                value = knots[n] + (knots[n + 1] - knots[n]) * (index - positions[n]) / float(positions[n + 1] - positions[n])
+                worst = max(worst, abs(value - cooldown_scale(index)))
+    return worst
+
+
+def generate(header_text):
+    ptper = read_define(header_text, "FCY_CLK") // read_define(header_text, "MOTOR_PWM_FREQ")
+    end_index = int(math.ceil(COOLDOWN_DURATION_SECONDS / COOLDOWN_SLOT_SECONDS))
+    positions, knots = cooldown_knots(end_index)
+
+    lines = []
+    lines.append("// Generated by tools/generate_tables.py - DO NOT EDIT, change the parameters in the generator and run \"make tables\"")
+    lines.append("#ifndef __A37434_TABLES_H")
+    lines.append("#define __A37434_TABLES_H")
+    lines.append("")
+    lines.append("/*")
+    lines.append("  PWM quarter tables, PTPER = %d" % ptper)
+    lines.append("  value = %d%% + peak * sin(pi * index / (MOTOR_PWM_TABLE_SIZE/2)) of 2*PTPER" % PWM_MINIMUM_PERCENT)
+    lines.append("  FULL_POWER peak = %d%%, LOW_POWER peak = %d%%" % (RUN_CURRENT_PERCENT, HOLD_CURRENT_PERCENT))
+    lines.append("*/")
+    for name, percent in (("FULL_POWER", RUN_CURRENT_PERCENT), ("LOW_POWER", HOLD_CURRENT_PERCENT)):
+        for microsteps in MICROSTEP_RESOLUTIONS:
+            values = pwm_quarter_table(ptper, microsteps, percent)
+            lines.append("#define %s_QUARTER_TABLE_VALUES_%d %s" % (name, microsteps, ",".join(str(v) for v in values)))
+            lines.append("")
+    lines.append("/*")
+    lines.append("  Cooldown knots, %g second slots, ends after %d seconds" % (COOLDOWN_SLOT_SECONDS, COOLDOWN_DURATION_SECONDS))
+    for fraction, time_constant in COOLDOWN_TERMS:
+        lines.append("  %.2f * exp(-t / %gs)" % (fraction, time_constant))
+    lines.append("  Limited to %.2f, interpolation error %d/32768" % (COOLDOWN_MAX_SCALE, int(math.ceil(interpolation_error(positions, knots, end_index)))))
+    lines.append("*/")
+    lines.append("#define COOL_DOWN_KNOT_VALUES %s" % ",".join(str(v) for v in knots))
+    lines.append("#define COOL_DOWN_KNOTS                   %d" % len(knots))
+    lines.append("#define COOL_DOWN_END_INDEX               %d" % end_index)
+    lines.append("")
+    lines.append("#endif")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the A37434 PWM and cooldown tables")
+    parser.add_argument("--check", action="store_true", help="compare with the committed tables instead of writing them")
+    args = parser.parse_args()
+
+    project_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    with open(os.path.join(project_dir, "A37434.h")) as header:
+        tables = generate(header.read())
+    output_path = os.path.join(project_dir, HEADER_NAME)
+
+    if args.check:
+        try:
+            with open(output_path) as existing:
+                current = existing.read()
+        except IOError:
+            current = ""
+        if current != tables:
+            sys.stderr.write("%s does not match tools/generate_tables.py, run \"make tables\"\n" % HEADER_NAME)
+            return 1
+        return 0
+
+    with open(output_path, "w") as output:
+        output.write(tables)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())